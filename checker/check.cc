@@ -14,10 +14,24 @@
 
 #include "check.h"
 
+#include "evaluate.h"
+
 namespace compiler::checker {
 
-bool check(shared_ptr<Error> error, shared_ptr<parser::Module> module) {
-  // In our toy language, it is impossible to have semantic errors
+bool check(shared_ptr<Error> error, shared_ptr<parser::Module> module,
+           vector<int64_t>* results) {
+  // The only semantic errors in our toy language are undefined operations
+  vector<int64_t> values;
+  if (!evaluate(error, module->nodes, values)) {
+    return false;
+  }
+  if (results) {
+    results->clear();
+    results->reserve(module->expressions.size());
+    for (auto expression : module->expressions) {
+      results->push_back(values[expression]);
+    }
+  }
   return true;
 }
 
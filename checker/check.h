@@ -19,6 +19,10 @@
 
 namespace compiler::checker {
 
-bool check(shared_ptr<Error> error, shared_ptr<parser::Module> module);
+// Checks the given module for semantic errors, returning false if there
+// were any. Every program is constant, so we evaluate it; see evaluate(). If
+// `results` is given, we store the value of each top-level expression in it.
+bool check(shared_ptr<Error> error, shared_ptr<parser::Module> module,
+           vector<int64_t>* results = nullptr);
 
 }
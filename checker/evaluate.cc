@@ -0,0 +1,105 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "evaluate.h"
+
+namespace compiler::checker {
+
+// Returns the error message for applying `op` to the given operands, or
+// null if the result is defined.
+static const char* undefined(parser::NodeTable::Opcode op, int64_t lhs,
+                             int64_t rhs) {
+  switch (op) {
+    case parser::NodeTable::DIVIDE:
+    case parser::NodeTable::MOD:
+      if (rhs == 0) {
+        return "division by zero";
+      } else if (lhs == INT64_MIN && rhs == -1) {
+        return "division overflows";
+      }
+      return nullptr;
+    case parser::NodeTable::SHIFT_LEFT:
+    case parser::NodeTable::SHIFT_RIGHT:
+      if (static_cast<uint64_t>(rhs) >= 64) {
+        return "shift amount must be between 0 and 63";
+      }
+      return nullptr;
+    default:
+      return nullptr;
+  }
+}
+
+// Applies `op` to operands for which it is defined. We compute wrapping
+// operations on unsigned integers, whose overflow is defined in C++.
+static int64_t apply(parser::NodeTable::Opcode op, int64_t lhs, int64_t rhs) {
+  auto a = static_cast<uint64_t>(lhs);
+  auto b = static_cast<uint64_t>(rhs);
+  switch (op) {
+    case parser::NodeTable::ADD:
+      return a + b;
+    case parser::NodeTable::SUBTRACT:
+      return a - b;
+    case parser::NodeTable::DIVIDE:
+      return lhs / rhs;
+    case parser::NodeTable::MULTIPLY:
+      return a * b;
+    case parser::NodeTable::MOD:
+      return lhs % rhs;
+    case parser::NodeTable::SHIFT_LEFT:
+      return a << b;
+    case parser::NodeTable::SHIFT_RIGHT:
+      return a >> b;
+    case parser::NodeTable::BIT_AND:
+      return a & b;
+    case parser::NodeTable::BIT_OR:
+      return a | b;
+    case parser::NodeTable::BIT_XOR:
+      return a ^ b;
+    case parser::NodeTable::INTEGER_LITERAL:
+      break;
+  }
+  return 0;
+}
+
+bool evaluate(shared_ptr<Error> error, const parser::NodeTable& nodes,
+              vector<int64_t>& values) {
+  // Operands always precede the nodes that use them, even when nodes are
+  // shared, so we can evaluate the whole table in a single forward scan. We
+  // only report the first undefined operation in each expression.
+  values.resize(nodes.size());
+  vector<bool> poisoned;
+  for (parser::NodeTable::Index i = 0; i < nodes.size(); i++) {
+    if (!nodes.is_binary(i)) {
+      values[i] = nodes.value(i);
+      continue;
+    }
+    auto lhs = nodes.lhs[i];
+    auto rhs = nodes.rhs[i];
+    if (!poisoned.empty() && (poisoned[lhs] || poisoned[rhs])) {
+      poisoned[i] = true;
+      continue;
+    }
+    auto op = nodes.opcodes[i];
+    if (auto message = undefined(op, values[lhs], values[rhs])) {
+      error->report(Error::ERROR, nodes.locations[i], message);
+      poisoned.resize(nodes.size());
+      poisoned[i] = true;
+      continue;
+    }
+    values[i] = apply(op, values[lhs], values[rhs]);
+  }
+  return poisoned.empty();
+}
+
+}
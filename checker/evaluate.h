@@ -0,0 +1,33 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../core/error.h"
+#include "../parser/table.h"
+
+namespace compiler::checker {
+
+// Computes the value of every node in the table at compile time, with the
+// same semantics as the LLVM instructions we emit for them: arithmetic wraps
+// on overflow, / and % round toward zero, and >> is a logical shift. The
+// operations LLVM leaves undefined, i.e., dividing by zero, dividing the
+// smallest integer by -1, and shifting by less than 0 or more than 63 bits,
+// are reported as errors at the node that performs them. Returns false if
+// there were any, in which case the values of those nodes and of the nodes
+// that use them are unspecified.
+bool evaluate(shared_ptr<Error> error, const parser::NodeTable& nodes,
+              vector<int64_t>& values);
+
+}
@@ -25,7 +25,10 @@
 #include <unistd.h>
 
 #include "../checker/check.h"
+#include "../checker/evaluate.h"
+#include "../core/thread_pool.h"
 #include "../emitter/emit.h"
+#include "../emitter/machine.h"
 #include "../emitter/optimize.h"
 #include "../parser/parse.h"
 
@@ -35,13 +38,262 @@ Build::Build()
     : Command("build", "Build an executable binary for a program",
               {Option("strict", "Treat warnings as fatal errors"),
                Option("unoptimized", "Do not optimize the program"),
+               Option("O", "Optimization level: 0, 1, 2, 3, s or z",
+                      Option::OPTION, "3"),
+               Option("passes",
+                      "LLVM pass pipeline to run instead, as in opt -passes",
+                      Option::OPTION),
                Option("output", "Output binary name", Option::OPTION),
                Option("target", "Target architecture", Option::OPTION),
+               Option("cpu",
+                      "Processor to generate code for, or native for this "
+                      "one",
+                      Option::OPTION, "generic"),
+               Option("features",
+                      "Processor features to enable or disable, e.g., "
+                      "+avx2,-bmi2",
+                      Option::OPTION),
+               Option("reloc",
+                      "Relocation model: default, static, pic or "
+                      "dynamic-no-pic",
+                      Option::OPTION, "pic"),
+               Option("code-model",
+                      "Code model: default, tiny, small, kernel, medium or "
+                      "large",
+                      Option::OPTION, "default"),
                Option("linker", "Linker command", Option::OPTION, "cc"),
-               Option("object", "Generate an unlinked object file")},
+               Option("object", "Generate an unlinked object file"),
+               Option("share", "Emit identical subexpressions once"),
+               Option("function-size",
+                      "Maximum expressions per function we compile",
+                      Option::OPTION, "4096"),
+               Option("jobs",
+                      "Threads to parse and compile with (1 by default), or 0 "
+                      "for one per core",
+                      Option::OPTION, "1"),
+               Option("stream",
+                      "Compile expressions as they are parsed in bounded "
+                      "memory"),
+               Option("image",
+                      "Render the output at compile time and print it with "
+                      "a single write"),
+               Option("verbose", "Print details of compilation to stderr"),
+               Option("time", "Print the time of each phase to stderr"),
+               Option("time-format", "Format of -time: text or json",
+                      Option::OPTION, "text"),
+               Option("trace",
+                      "Write a timeline of the command to the given path as "
+                      "Chrome trace JSON",
+                      Option::OPTION)},
               "path") {
 }
 
+// Creates an empty temporary object file, returning its path, or an empty
+// string if the file could not be created.
+static string create_object_file(shared_ptr<Error> error) {
+  char object_path[PATH_MAX];
+  auto pattern = filesystem::temp_directory_path() / "XXXXXXXXXX.o";
+  strcpy(object_path, pattern.c_str());
+  auto object_fd = mkstemps(object_path, 2);
+  if (object_fd == -1) {
+    error->report(Error::ERROR,
+                  "Could not create temporary file: " + string(object_path));
+    return "";
+  }
+  close(object_fd);
+  return object_path;
+}
+
+// Compiles the given LLVM module to an object file at the given path.
+static bool write_object_file(shared_ptr<Error> error,
+                              llvm::TargetMachine* llvm_machine,
+                              llvm::Module* llvm_module,
+                              const string& object_path) {
+  std::error_code file_error;
+  llvm::raw_fd_ostream out(object_path, file_error, llvm::sys::fs::F_None);
+  if (file_error) {
+    error->report(Error::ERROR,
+                  "Could not write file: " + file_error.message());
+    return false;
+  }
+  llvm::legacy::PassManager pass;
+  if (llvm_machine->addPassesToEmitFile(pass, out, nullptr,
+                                        llvm::CGFT_ObjectFile)) {
+    error->report(
+        Error::ERROR,
+        "LLVM cannot emit object files for the target architecture: " +
+            llvm_machine->getTargetTriple().str());
+    return false;
+  }
+  pass.run(*llvm_module);
+  out.flush();
+  return true;
+}
+
+// Compiles the program into `partitions` object files on up to `jobs`
+// threads, each partition with its own LLVM context and target machine, plus
+// an object file that defines the runtime and a main function that calls the
+// functions of every partition in order. Partitions are contiguous ranges of
+// top-level expressions, so the object files only depend on the program and
+// the number of partitions. We append the paths of the object files we create
+// to `object_paths` in order. Optimizers cannot be shared between threads,
+// so each partition builds its own unless `optimize_options` is null. We add
+// the phases of every thread to `timing` if it is not null.
+static bool compile_partitions(
+    shared_ptr<Error> error, shared_ptr<parser::Module> module,
+    const llvm::Target* llvm_target, const string& target,
+    const emitter::MachineOptions& machine,
+    const emitter::OptimizeOptions* optimize_options, size_t function_size,
+    size_t partitions, unsigned jobs, Timing* timing,
+    vector<string>& object_paths) {
+  auto size = module->expressions.size();
+  auto name = module->path.string();
+  vector<vector<string>> functions(partitions);
+  vector<string> paths(partitions);
+  vector<shared_ptr<Error::Buffer>> errors(partitions);
+  vector<char> results(partitions);
+  ThreadPool pool(std::min<size_t>(jobs, partitions));
+  pool.run(partitions, [&](size_t i) {
+    errors[i] = make_shared<Error::Buffer>();
+    Timing::Span span(timing, "compile partition", std::to_string(i));
+    Timing::Phase emit_phase(timing, name, "emit");
+    llvm::LLVMContext llvm_context;
+    llvm::Module llvm_module(module->path.string(), llvm_context);
+    std::unique_ptr<llvm::TargetMachine> llvm_machine(
+        emitter::create_target_machine(llvm_target, target, machine));
+    llvm_module.setDataLayout(llvm_machine->createDataLayout());
+    llvm_module.setTargetTriple(llvm_machine->getTargetTriple().str());
+    functions[i] = emitter::emit_functions(
+        module, &llvm_module, size * i / partitions,
+        size * (i + 1) / partitions, function_size,
+        "chunk." + std::to_string(i) + ".", llvm::Function::ExternalLinkage,
+        timing);
+    emit_phase.stop();
+    if (optimize_options) {
+      auto optimizer = emitter::Optimizer::create(errors[i], *optimize_options);
+      if (!optimizer) {
+        return;
+      }
+      optimizer->optimize(&llvm_module);
+    }
+    Timing::Phase codegen_phase(timing, name, "codegen");
+    paths[i] = create_object_file(errors[i]);
+    results[i] = !paths[i].empty() &&
+                 write_object_file(errors[i], llvm_machine.get(), &llvm_module,
+                                   paths[i]);
+  });
+
+  bool success = true;
+  vector<string> names;
+  for (size_t i = 0; i < partitions; i++) {
+    errors[i]->flush(*error);
+    if (!paths[i].empty()) {
+      object_paths.push_back(paths[i]);
+    }
+    success = success && results[i];
+    names.insert(names.end(), functions[i].begin(), functions[i].end());
+  }
+  if (!success) {
+    return false;
+  }
+
+  Timing::Phase emit_phase(timing, name, "emit");
+  llvm::LLVMContext llvm_context;
+  llvm::Module llvm_module(module->path.string(), llvm_context);
+  std::unique_ptr<llvm::TargetMachine> llvm_machine(
+      emitter::create_target_machine(llvm_target, target, machine));
+  llvm_module.setDataLayout(llvm_machine->createDataLayout());
+  llvm_module.setTargetTriple(llvm_machine->getTargetTriple().str());
+  emitter::emit_main(&llvm_module, names);
+  emitter::emit_runtime(&llvm_module);
+  emit_phase.stop();
+  Timing::Phase codegen_phase(timing, name, "codegen");
+  auto object_path = create_object_file(error);
+  if (object_path.empty()) {
+    return false;
+  }
+  object_paths.push_back(object_path);
+  return write_object_file(error, llvm_machine.get(), &llvm_module,
+                           object_path);
+}
+
+// Compiles the program as it is parsed, writing an object file for each batch
+// of expressions with a fresh LLVM context, so memory use does not grow with
+// the size of the input. Each batch becomes a function, and a final object
+// file defines the runtime and a main function that calls them in order. We
+// check each expression as it is parsed and stop at the first error. We
+// append the paths of the object files we create to `object_paths`. Parsing
+// is interleaved with the other phases, so we only add the phases of each
+// batch to `timing`, if it is not null.
+static bool stream(shared_ptr<Error> error, const filesystem::path& path,
+                   llvm::TargetMachine* llvm_machine,
+                   emitter::Optimizer* optimizer, Timing* timing,
+                   vector<string>& object_paths) {
+  auto name = path.string();
+  std::unique_ptr<llvm::Module> llvm_module;
+  vector<int64_t> values;
+  bool success = true;
+
+  auto start_module = [&](llvm::LLVMContext& context) {
+    llvm_module = std::make_unique<llvm::Module>(name, context);
+    llvm_module->setDataLayout(llvm_machine->createDataLayout());
+    llvm_module->setTargetTriple(llvm_machine->getTargetTriple().str());
+    return llvm_module.get();
+  };
+
+  auto finish_module = [&]() {
+    if (optimizer) {
+      optimizer->optimize(llvm_module.get());
+    }
+    Timing::Phase codegen_phase(timing, name, "codegen");
+    auto object_path = create_object_file(error);
+    if (object_path.empty()) {
+      success = false;
+    } else {
+      object_paths.push_back(object_path);
+      success = write_object_file(error, llvm_machine, llvm_module.get(),
+                                  object_path);
+    }
+    llvm_module.reset();
+  };
+
+  emitter::BatchEmitter batches(
+      [&](llvm::LLVMContext& context, const string& function) {
+        return start_module(context);
+      },
+      [&](llvm::Module*, llvm::Function*) { finish_module(); }, name,
+      timing);
+
+  auto parsed = parser::parse(
+      error, path,
+      [&](const parser::NodeTable& nodes, parser::NodeTable::Index expression,
+          bool input_pending) {
+        if (!success) {
+          return;
+        }
+        Timing::Phase check_phase(timing, name, "check", false);
+        if (!checker::evaluate(error, nodes, values)) {
+          success = false;
+          return;
+        }
+        check_phase.stop();
+        batches.add(nodes, expression);
+      });
+  batches.finish();
+  if (!parsed || !success) {
+    return false;
+  }
+
+  Timing::Phase emit_phase(timing, name, "emit");
+  llvm::LLVMContext llvm_context;
+  start_module(llvm_context);
+  emitter::emit_main(llvm_module.get(), batches.functions());
+  emitter::emit_runtime(llvm_module.get());
+  emit_phase.stop();
+  finish_module();
+  return success;
+}
+
 bool Build::execute(const filesystem::path& executable,
                     map<string, bool>& flags, map<string, string>& options,
                     vector<string>& arguments) {
@@ -55,26 +307,86 @@ bool Build::execute(const filesystem::path& executable,
   llvm::InitializeAllTargets();
   llvm::InitializeAllTargetMCs();
   llvm::InitializeAllAsmPrinters();
+  if (flags["time"]) {
+    emitter::time_code_generation(timing.get());
+  }
+
+  size_t function_size, level;
+  unsigned jobs;
+  emitter::MachineOptions machine;
+  if (!parse_count("function-size", options["function-size"], function_size) ||
+      !parse_jobs(options["jobs"], jobs) ||
+      !parse_choice("O", options["O"], {"0", "1", "2", "3", "s", "z"},
+                    level) ||
+      !parse_machine(options, machine)) {
+    return false;
+  }
+  emitter::OptimizeOptions optimize_options;
+  optimize_options.level = static_cast<emitter::OptimizationLevel>(level);
+  optimize_options.passes = options["passes"];
+  optimize_options.timing = timing.get();
+  if (jobs == 0) {
+    jobs = std::max(std::thread::hardware_concurrency(), 1u);
+  }
 
-  // Parse the program
   auto error = make_shared<Error::Terminal>();
   auto fail_level = flags["strict"] ? Error::WARNING : Error::ERROR;
-  auto module = parser::parse(error, arguments[0]);
-  if (!module) {
+  if (flags["stream"] && flags["object"]) {
+    error->report(Error::ERROR, "-stream cannot be combined with -object");
     return false;
   }
-
-  // Check for correctness
-  auto symbols = checker::check(error, module);
-  if (!symbols || error->count(fail_level) > 0) {
+  if (flags["stream"] && flags["image"]) {
+    error->report(Error::ERROR, "-stream cannot be combined with -image");
     return false;
   }
+  if (jobs > 1 && (flags["stream"] || flags["object"])) {
+    error->report(Error::ERROR, string("-jobs cannot be combined with -") +
+                                    (flags["stream"] ? "stream" : "object"));
+    return false;
+  }
+
+  // Build the optimization pipeline once for all of the modules we compile
+  std::unique_ptr<emitter::Optimizer> optimizer;
+  if (!flags["unoptimized"]) {
+    optimizer = emitter::Optimizer::create(error, optimize_options);
+    if (!optimizer) {
+      return false;
+    }
+  }
+
+  // Parse the program
+  shared_ptr<parser::Module> module;
+  vector<int64_t> results;
+  if (!flags["stream"]) {
+    parser::ParseOptions parse_options;
+    parse_options.jobs = jobs;
+    parse_options.share = flags["share"];
+    parse_options.timing = timing.get();
+    Timing::Phase parse_phase(timing.get(), arguments[0], "parse");
+    module = parser::parse(error, arguments[0], parse_options);
+    parse_phase.stop();
+    if (!module) {
+      return false;
+    }
+
+    // Check for correctness, which computes the output of the program
+    Timing::Phase check_phase(timing.get(), arguments[0], "check");
+    auto checked =
+        checker::check(error, module, flags["image"] ? &results : nullptr);
+    check_phase.stop();
+    if (!checked || error->count(fail_level) > 0) {
+      return false;
+    }
+  }
 
   // Emit LLVM IR code
   llvm::LLVMContext llvm_context;
   string target = options["target"];
   if (target.empty()) {
     target = llvm::sys::getDefaultTargetTriple();
+  } else if (machine.cpu == "native") {
+    error->report(Error::ERROR, "-cpu=native cannot be combined with -target");
+    return false;
   }
   string llvm_error;
   auto llvm_target =
@@ -83,47 +395,70 @@ bool Build::execute(const filesystem::path& executable,
     error->report(Error::ERROR, llvm_error);
     return false;
   }
-  auto llvm_machine = llvm_target->createTargetMachine(
-      target.c_str(), "generic", "", llvm::TargetOptions(),
-      llvm::Reloc::Model::PIC_);
-  auto llvm_module = new llvm::Module(arguments[0], llvm_context);
-  llvm_module->setDataLayout(llvm_machine->createDataLayout());
-  auto llvm_function = emitter::emit(module, llvm_module);
-  if (!llvm_function) {
+  if (!emitter::resolve_machine(error, llvm_target, target, machine)) {
     return false;
   }
-  if (!flags["unoptimized"]) {
-    emitter::optimize(llvm_module);
+  auto llvm_machine =
+      emitter::create_target_machine(llvm_target, target, machine);
+  if (flags["verbose"]) {
+    std::cerr << emitter::describe_machine(llvm_machine) << std::endl;
   }
 
-  // Write the object file
-  char object_path[PATH_MAX];
-  auto pattern = filesystem::temp_directory_path() / "XXXXXXXXXX.o";
-  strcpy(object_path, pattern.c_str());
-  auto object_fd = mkstemps(object_path, 2);
-  if (object_fd == -1) {
-    error->report(Error::ERROR,
-                  "Could not create temporary file: " + string(object_path));
-    return false;
+  // Split large programs into one partition per thread, but never into
+  // partitions smaller than a function
+  size_t partitions = 1;
+  if (!flags["stream"] && !flags["image"]) {
+    auto size = module->expressions.size();
+    partitions = std::max<size_t>(
+        1, std::min<size_t>(jobs, size / function_size));
   }
-  close(object_fd);
-  std::error_code file_error;
-  llvm::raw_fd_ostream out(object_path, file_error, llvm::sys::fs::F_None);
-  if (file_error) {
-    error->report(Error::ERROR,
-                  "Could not write file: " + file_error.message());
-    return false;
-  }
-  llvm::legacy::PassManager pass;
-  if (llvm_machine->addPassesToEmitFile(pass, out, nullptr,
-                                        llvm::CGFT_ObjectFile)) {
-    error->report(
-        Error::ERROR,
-        "LLVM cannot emit object files for the target architecture: " + target);
-    return false;
+
+  // Write the object files
+  vector<string> object_paths;
+  if (flags["stream"] || partitions > 1) {
+    bool success =
+        flags["stream"]
+            ? stream(error, arguments[0], llvm_machine, optimizer.get(),
+                     timing.get(), object_paths)
+            : compile_partitions(error, module, llvm_target, target, machine,
+                                 optimizer ? &optimize_options : nullptr,
+                                 function_size, partitions, jobs,
+                                 timing.get(), object_paths);
+    if (!success || error->count(fail_level) > 0) {
+      for (auto& object_path : object_paths) {
+        unlink(object_path.c_str());
+      }
+      return false;
+    }
+  } else {
+    Timing::Phase emit_phase(timing.get(), arguments[0], "emit");
+    auto llvm_module = new llvm::Module(arguments[0], llvm_context);
+    llvm_module->setDataLayout(llvm_machine->createDataLayout());
+    llvm_module->setTargetTriple(llvm_machine->getTargetTriple().str());
+    if (flags["image"]) {
+      emitter::emit_image(llvm_module, results);
+    } else {
+      auto llvm_function = emitter::emit(module, llvm_module, function_size,
+                                         timing.get());
+      if (!llvm_function) {
+        return false;
+      }
+      emitter::emit_runtime(llvm_module);
+    }
+    emit_phase.stop();
+    if (optimizer) {
+      optimizer->optimize(llvm_module);
+    }
+    Timing::Phase codegen_phase(timing.get(), arguments[0], "codegen");
+    auto object_path = create_object_file(error);
+    if (object_path.empty()) {
+      return false;
+    }
+    object_paths.push_back(object_path);
+    if (!write_object_file(error, llvm_machine, llvm_module, object_path)) {
+      return false;
+    }
   }
-  pass.run(*llvm_module);
-  out.flush();
 
   // Determine our output file name
   string output_name = options["output"];
@@ -136,22 +471,35 @@ bool Build::execute(const filesystem::path& executable,
 
   // Finish with the object file if requested
   if (flags["object"]) {
-    if (rename(object_path, output_name.c_str()) == -1) {
+    auto& object_path = object_paths[0];
+    if (rename(object_path.c_str(), output_name.c_str()) == -1) {
       error->report(Error::ERROR,
-                    "Could not move " + string(object_path) + " to " + name);
+                    "Could not move " + object_path + " to " + name);
       return false;
     }
-    unlink(object_path);
+    unlink(object_path.c_str());
     return true;
   }
 
-  // Link the object file using the cc command to include the C standard library
-  string command = options["linker"] + " " + object_path + " -o " + output_name;
+  // Link the object files using the cc command to include the C standard
+  // library. Compilers link position-independent executables by default,
+  // which code for other relocation models cannot be part of.
+  string command = options["linker"];
+  for (auto& object_path : object_paths) {
+    command += " " + object_path;
+  }
+  if (llvm_machine->getRelocationModel() != llvm::Reloc::PIC_) {
+    command += " -no-pie";
+  }
+  command += " -o " + output_name;
+  Timing::Phase link_phase(timing.get(), arguments[0], "link");
   if (system(command.c_str()) == -1) {
     error->report(Error::ERROR, "Could not execute linker: " + command);
     return false;
   }
-  unlink(object_path);
+  for (auto& object_path : object_paths) {
+    unlink(object_path.c_str());
+  }
   return true;
 }
 
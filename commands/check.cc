@@ -23,7 +23,21 @@ namespace compiler::commands {
 
 Check::Check()
     : Command("check", "Check the correctness of a module",
-              {Option("strict", "Treat warnings as fatal errors")}, "path…") {
+              {Option("strict", "Treat warnings as fatal errors"),
+               Option("jobs",
+                      "Threads to check with, or 0 for one per core (the "
+                      "default)",
+                      Option::OPTION, "0"),
+               Option("parser", "Parser to use (bison or pratt)",
+                      Option::OPTION),
+               Option("time", "Print the time of each phase to stderr"),
+               Option("time-format", "Format of -time: text or json",
+                      Option::OPTION, "text"),
+               Option("trace",
+                      "Write a timeline of the command to the given path as "
+                      "Chrome trace JSON",
+                      Option::OPTION)},
+              "path…") {
 }
 
 bool Check::execute(const filesystem::path& executable,
@@ -33,21 +47,31 @@ bool Check::execute(const filesystem::path& executable,
     print_help(executable);
     return false;
   }
-  auto fail_level = flags["strict"] ? Error::WARNING : Error::ERROR;
-  bool success = true;
-  for (auto& path : arguments) {
-    auto error = make_shared<Error::Terminal>();
-    auto module = parser::parse(error, path);
-    if (!module) {
-      success = false;
-      continue;
-    }
-    auto symbols = checker::check(error, module);
-    if (!symbols || error->count(fail_level) > 0) {
-      success = false;
-    }
+  unsigned jobs;
+  parser::ParseOptions parse_options;
+  if (!parse_jobs(options["jobs"], jobs) ||
+      !parse_parser(options["parser"], parse_options.pratt) ||
+      !expand_response_files(arguments)) {
+    return false;
   }
-  return success;
+  auto fail_level = flags["strict"] ? Error::WARNING : Error::ERROR;
+  return process_files(
+      arguments, jobs, fail_level,
+      [parse_options, timing = timing.get()](shared_ptr<Error> error,
+                                             const filesystem::path& path,
+                                             unsigned jobs) {
+        auto file_options = parse_options;
+        file_options.jobs = jobs;
+        file_options.timing = timing;
+        Timing::Phase parse_phase(timing, path, "parse");
+        auto module = parser::parse(error, path, file_options);
+        parse_phase.stop();
+        if (!module) {
+          return false;
+        }
+        Timing::Phase check_phase(timing, path, "check");
+        return checker::check(error, module);
+      });
 }
 
 }
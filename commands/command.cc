@@ -14,8 +14,12 @@
 
 #include "command.h"
 
+#include <algorithm>
+#include <fstream>
+#include <stdlib.h>
 #include <unistd.h>
 
+#include "../core/thread_pool.h"
 #include "color.h"
 
 namespace compiler::commands {
@@ -59,6 +63,17 @@ bool Command::run(const filesystem::path& executable,
         option_name = option_string;
       }
       auto option_loc = option_map.find(option_name);
+      if (option_loc == option_map.end() && loc == string::npos) {
+        // Options with single-letter names may be followed by their values
+        // directly, e.g., -O2
+        option_loc = option_map.find(option_name.substr(0, 1));
+        if (option_loc != option_map.end() &&
+            option_loc->second.type == Option::OPTION) {
+          option_value = option_name.substr(1);
+        } else {
+          option_loc = option_map.end();
+        }
+      }
       if (option_loc == option_map.end()) {
         std::cerr << "Unrecognized option: " << color.error(argument)
                   << std::endl;
@@ -96,7 +111,41 @@ bool Command::run(const filesystem::path& executable,
     }
   }
 
-  return execute(executable, flag_arguments, option_arguments, tail);
+  auto& trace_path = option_arguments["trace"];
+  if (!flag_arguments["time"] && trace_path.empty()) {
+    return execute(executable, flag_arguments, option_arguments, tail);
+  }
+
+  // Time the command and print the times to stderr, where they do not mix
+  // with the output of programs we run. We open the trace file first, so we
+  // do not run a long command only to fail to write its trace.
+  size_t format = 0;
+  if (flag_arguments["time"] &&
+      !parse_choice("time-format", option_arguments["time-format"],
+                    {"text", "json"}, format)) {
+    return false;
+  }
+  std::ofstream trace_file;
+  if (!trace_path.empty()) {
+    trace_file.open(trace_path);
+    if (!trace_file) {
+      std::cerr << "Could not write trace file " << color.error(trace_path)
+                << std::endl;
+      return false;
+    }
+  }
+  timing = make_shared<Timing>(!trace_path.empty());
+  auto result = execute(executable, flag_arguments, option_arguments, tail);
+  if (flag_arguments["time"] && format == 0) {
+    timing->print(std::cerr);
+  } else if (flag_arguments["time"]) {
+    timing->print_json(std::cerr);
+  }
+  if (trace_file.is_open()) {
+    timing->print_trace(trace_file);
+  }
+  timing.reset();
+  return result;
 }
 
 void Command::print_help(const filesystem::path& executable) {
@@ -142,4 +191,143 @@ void Command::print_help(const filesystem::path& executable, std::ostream& out,
       << "` to show documentation for all commands." << std::endl;
 }
 
-}
\ No newline at end of file
+bool Command::expand_response_files(vector<string>& arguments) {
+  vector<string> expanded;
+  for (auto& argument : arguments) {
+    if (argument.size() < 2 || argument[0] != '@') {
+      expanded.push_back(argument);
+      continue;
+    }
+    std::ifstream file(argument.substr(1));
+    if (!file) {
+      Color color(isatty(STDERR_FILENO));
+      std::cerr << "Could not read response file "
+                << color.error(argument.substr(1)) << std::endl;
+      return false;
+    }
+    string line;
+    while (std::getline(file, line)) {
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (!line.empty()) {
+        expanded.push_back(line);
+      }
+    }
+  }
+  arguments = std::move(expanded);
+  return true;
+}
+
+bool Command::parse_jobs(const string& value, unsigned& jobs) {
+  char* end;
+  auto number = strtoul(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || number > 1024) {
+    Color color(isatty(STDERR_FILENO));
+    std::cerr << "Option " << color.error("jobs")
+              << " requires a number of threads" << std::endl;
+    return false;
+  }
+  jobs = number;
+  return true;
+}
+
+bool Command::parse_parser(const string& value, bool& pratt) {
+  if (value == "bison" || value == "pratt") {
+    pratt = value == "pratt";
+  } else if (!value.empty()) {
+    Color color(isatty(STDERR_FILENO));
+    std::cerr << "Option " << color.error("parser")
+              << " requires bison or pratt" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Command::parse_count(const string& name, const string& value,
+                          size_t& count) {
+  char* end;
+  auto number = strtoull(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || number == 0) {
+    Color color(isatty(STDERR_FILENO));
+    std::cerr << "Option " << color.error(name)
+              << " requires a positive number" << std::endl;
+    return false;
+  }
+  count = number;
+  return true;
+}
+
+bool Command::parse_machine(map<string, string>& options,
+                            emitter::MachineOptions& machine) {
+  // The choices after "default" are in the order of LLVM's enums
+  size_t reloc, code_model;
+  if (!parse_choice("reloc", options["reloc"],
+                    {"default", "static", "pic", "dynamic-no-pic"}, reloc) ||
+      !parse_choice("code-model", options["code-model"],
+                    {"default", "tiny", "small", "kernel", "medium", "large"},
+                    code_model)) {
+    return false;
+  }
+  machine.cpu = options["cpu"];
+  machine.features = options["features"];
+  if (reloc > 0) {
+    machine.reloc = static_cast<llvm::Reloc::Model>(reloc - 1);
+  }
+  if (code_model > 0) {
+    machine.code_model = static_cast<llvm::CodeModel::Model>(code_model - 1);
+  }
+  return true;
+}
+
+bool Command::parse_choice(const string& name, const string& value,
+                           const vector<string>& choices, size_t& choice) {
+  auto found = std::find(choices.begin(), choices.end(), value);
+  if (found == choices.end()) {
+    Color color(isatty(STDERR_FILENO));
+    std::cerr << "Option " << color.error(name) << " requires ";
+    for (size_t i = 0; i < choices.size(); i++) {
+      if (i > 0) {
+        std::cerr << (i + 1 < choices.size() ? ", " : " or ");
+      }
+      std::cerr << choices[i];
+    }
+    std::cerr << std::endl;
+    return false;
+  }
+  choice = found - choices.begin();
+  return true;
+}
+
+bool Command::process_files(const vector<string>& paths, unsigned jobs,
+                            Error::Level fail_level,
+                            const FileProcessor& process) {
+  unsigned threads =
+      jobs ? jobs : std::max(std::thread::hardware_concurrency(), 1u);
+  ThreadPool pool(std::min<size_t>(threads, std::max<size_t>(paths.size(), 1)));
+  vector<shared_ptr<Error::Buffer>> errors(paths.size());
+  vector<bool> results(paths.size());
+  std::mutex mutex;
+  size_t next = 0;
+  bool success = true;
+  pool.run(paths.size(), [&](size_t i) {
+    auto error = make_shared<Error::Buffer>();
+    auto result = process(error, paths[i], paths.size() == 1 ? jobs : 1) &&
+                  error->count(fail_level) == 0;
+
+    // Print the diagnostics of every file whose predecessors are done
+    std::lock_guard<std::mutex> lock(mutex);
+    errors[i] = error;
+    results[i] = result;
+    while (next < paths.size() && errors[next]) {
+      Error::Terminal terminal;
+      errors[next]->flush(terminal);
+      errors[next].reset();
+      success = success && results[next];
+      next++;
+    }
+  });
+  return success;
+}
+
+}
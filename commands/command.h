@@ -14,9 +14,13 @@
 
 #pragma once
 
+#include <functional>
 #include <iostream>
 
 #include "../core/common.h"
+#include "../core/error.h"
+#include "../core/timing.h"
+#include "../emitter/machine.h"
 
 namespace compiler::commands {
 
@@ -24,7 +28,8 @@ namespace compiler::commands {
 class Option {
  public:
   // A FLAG takes no arguments and represents a Boolean flag. An OPTION
-  // requires an argument.
+  // requires an argument, which follows an equals sign, or directly follows
+  // the name if the name is a single letter, e.g., -O2.
   enum Type {
     FLAG,
     OPTION,
@@ -76,9 +81,53 @@ class Command {
   string argument_placeholder;
 
  protected:
+  // If the command has a -time flag and it is given, the times of the phases
+  // of the command, which we print once it has executed. Otherwise null.
+  shared_ptr<Timing> timing;
+
   virtual bool execute(const filesystem::path& executable,
                        map<string, bool>& flags, map<string, string>& options,
                        vector<string>& arguments) = 0;
+
+  // Replaces each argument of the form @path with the lines of the file at
+  // that path, so commands can take more paths than fit on a command line.
+  // Returns false if a response file cannot be read.
+  static bool expand_response_files(vector<string>& arguments);
+
+  // Parses the value of a -jobs option, which is a number of threads, or 0
+  // to use one thread per core. Returns false if it is not a number.
+  static bool parse_jobs(const string& value, unsigned& jobs);
+
+  // Parses the value of a -parser option, which is "bison" or "pratt", or
+  // empty to keep the parser chosen at build time. Returns false if it names
+  // neither parser.
+  static bool parse_parser(const string& value, bool& pratt);
+
+  // Parses the value of an option that must be one of the given choices,
+  // setting `choice` to its index. Returns false if it is none of them.
+  static bool parse_choice(const string& name, const string& value,
+                           const vector<string>& choices, size_t& choice);
+
+  // Parses the value of an option that must be a positive number, e.g., a
+  // size. Returns false if it is not.
+  static bool parse_count(const string& name, const string& value,
+                          size_t& count);
+
+  // Parses the -cpu, -features, -reloc and -code-model options into
+  // `machine`. Returns false if a relocation or code model is unknown.
+  static bool parse_machine(map<string, string>& options,
+                            emitter::MachineOptions& machine);
+
+  // Calls `process` for each of the given files on up to `jobs` threads.
+  // Each file's diagnostics are printed together once it is processed, in
+  // the order of `paths`. `process` is given the number of threads it may
+  // use itself. Returns false if `process` fails for any file or reports
+  // errors at or above `fail_level`.
+  using FileProcessor = std::function<bool(
+      shared_ptr<Error> error, const filesystem::path& path, unsigned jobs)>;
+  static bool process_files(const vector<string>& paths, unsigned jobs,
+                            Error::Level fail_level,
+                            const FileProcessor& process);
 };
 
 }
@@ -14,6 +14,7 @@
 
 #include "ir.h"
 
+#include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/FileSystem.h>
@@ -21,6 +22,7 @@
 #include <unistd.h>
 
 #include "../checker/check.h"
+#include "../checker/evaluate.h"
 #include "../emitter/emit.h"
 #include "../emitter/optimize.h"
 #include "../parser/parse.h"
@@ -32,10 +34,127 @@ IR::IR()
           "ir", "Emit LLVM assembly language for a program",
           {Option("output", "Write IR code to the given path", Option::OPTION),
            Option("strict", "Treat warnings as fatal errors"),
-           Option("unoptimized", "Do not optimize the program")},
+           Option("unoptimized", "Do not optimize the program"),
+           Option("O", "Optimization level: 0, 1, 2, 3, s or z",
+                  Option::OPTION, "3"),
+           Option("passes",
+                  "LLVM pass pipeline to run instead, as in opt -passes",
+                  Option::OPTION),
+           Option("share", "Emit identical subexpressions once"),
+           Option("function-size", "Maximum expressions per function we emit",
+                  Option::OPTION, "4096"),
+           Option("stream",
+                  "Emit expressions as they are parsed in bounded memory"),
+           Option("image",
+                  "Render the output at compile time and print it with a "
+                  "single write"),
+           Option("time", "Print the time of each phase to stderr"),
+           Option("time-format", "Format of -time: text or json",
+                  Option::OPTION, "text"),
+           Option("trace",
+                  "Write a timeline of the command to the given path as "
+                  "Chrome trace JSON",
+                  Option::OPTION)},
           "path") {
 }
 
+// Removes the attributes from the functions and calls in the given module.
+// Attribute groups are numbered per module, so we cannot print them when we
+// concatenate functions from several modules.
+static void strip_attributes(llvm::Module* llvm_module) {
+  for (auto& function : *llvm_module) {
+    function.setAttributes(llvm::AttributeList());
+    for (auto& block : function) {
+      for (auto& instruction : block) {
+        if (auto call = llvm::dyn_cast<llvm::CallBase>(&instruction)) {
+          call->setAttributes(llvm::AttributeList());
+        }
+      }
+    }
+  }
+}
+
+// Emits the program as it is parsed, with a fresh LLVM context for each batch
+// of expressions, so memory use does not grow with the size of the input.
+// Each batch becomes a function, followed by a main function that calls them
+// in order. The first module defines the runtime. We print it in full, and
+// only the function definitions of subsequent modules, which refer to the
+// runtime declarations of the first by name. We check each expression as
+// it is parsed and stop at the first error. Parsing is interleaved with the
+// other phases, so we only add the phases of each batch to `timing`, if it
+// is not null.
+static bool stream(shared_ptr<Error> error, const filesystem::path& path,
+                   emitter::Optimizer* optimizer, Timing* timing,
+                   llvm::raw_ostream& out) {
+  auto name = path.string();
+  std::unique_ptr<llvm::Module> llvm_module;
+  size_t printed = 0;
+  vector<int64_t> values;
+  bool success = true;
+
+  auto start_module = [&](llvm::LLVMContext& context) {
+    llvm_module = std::make_unique<llvm::Module>(name, context);
+    if (printed == 0) {
+      emitter::emit_runtime(llvm_module.get());
+    }
+    return llvm_module.get();
+  };
+
+  auto print_module = [&]() {
+    if (optimizer) {
+      optimizer->optimize(llvm_module.get());
+    }
+    Timing::Phase print_phase(timing, name, "print");
+    strip_attributes(llvm_module.get());
+    if (printed == 0) {
+      llvm_module->print(out, nullptr);
+    } else {
+      for (auto& function : *llvm_module) {
+        if (!function.isDeclaration()) {
+          out << "\n";
+          function.print(out);
+        }
+      }
+    }
+    printed++;
+    llvm_module.reset();
+  };
+
+  emitter::BatchEmitter batches(
+      [&](llvm::LLVMContext& context, const string& function) {
+        return start_module(context);
+      },
+      [&](llvm::Module*, llvm::Function*) { print_module(); }, name, timing);
+
+  auto parsed = parser::parse(
+      error, path,
+      [&](const parser::NodeTable& nodes, parser::NodeTable::Index expression,
+          bool input_pending) {
+        if (!success) {
+          return;
+        }
+        Timing::Phase check_phase(timing, name, "check", false);
+        if (!checker::evaluate(error, nodes, values)) {
+          success = false;
+          return;
+        }
+        check_phase.stop();
+        batches.add(nodes, expression);
+      });
+  batches.finish();
+  if (!parsed || !success) {
+    return false;
+  }
+
+  Timing::Phase emit_phase(timing, name, "emit");
+  llvm::LLVMContext llvm_context;
+  start_module(llvm_context);
+  emitter::emit_main(llvm_module.get(), batches.functions());
+  emit_phase.stop();
+  print_module();
+  return true;
+}
+
 bool IR::execute(const filesystem::path& executable, map<string, bool>& flags,
                  map<string, string>& options, vector<string>& arguments) {
   if (arguments.size() < 1) {
@@ -43,32 +162,25 @@ bool IR::execute(const filesystem::path& executable, map<string, bool>& flags,
     return false;
   }
 
-  // Parse the program
-  auto error = make_shared<Error::Terminal>();
-  auto fail_level = flags["strict"] ? Error::WARNING : Error::ERROR;
-  auto module = parser::parse(error, arguments[0]);
-  if (!module) {
-    return false;
-  }
-
-  // Check for correctness
-  auto symbols = checker::check(error, module);
-  if (!symbols || error->count(fail_level) > 0) {
+  size_t function_size, level;
+  if (!parse_count("function-size", options["function-size"], function_size) ||
+      !parse_choice("O", options["O"], {"0", "1", "2", "3", "s", "z"},
+                    level)) {
     return false;
   }
+  emitter::OptimizeOptions optimize_options;
+  optimize_options.level = static_cast<emitter::OptimizationLevel>(level);
+  optimize_options.passes = options["passes"];
+  optimize_options.timing = timing.get();
 
-  // Emit LLVM IR code
-  llvm::LLVMContext llvm_context;
-  auto llvm_module = new llvm::Module(arguments[0], llvm_context);
-  auto llvm_function = emitter::emit(module, llvm_module);
-  if (!llvm_function) {
+  auto error = make_shared<Error::Terminal>();
+  auto fail_level = flags["strict"] ? Error::WARNING : Error::ERROR;
+  if (flags["stream"] && flags["image"]) {
+    error->report(Error::ERROR, "-stream cannot be combined with -image");
     return false;
   }
-  if (!flags["unoptimized"]) {
-    emitter::optimize(llvm_module);
-  }
 
-  // Write the LLVM IR
+  // Open the output file
   shared_ptr<llvm::raw_fd_ostream> out;
   if (!options["output"].empty()) {
     std::error_code file_error;
@@ -82,7 +194,64 @@ bool IR::execute(const filesystem::path& executable, map<string, bool>& flags,
   } else {
     out = make_shared<llvm::raw_fd_ostream>(STDOUT_FILENO, false);
   }
+
+  // Build the optimization pipeline once for all of the modules we emit
+  std::unique_ptr<emitter::Optimizer> optimizer;
+  if (!flags["unoptimized"]) {
+    optimizer = emitter::Optimizer::create(error, optimize_options);
+    if (!optimizer) {
+      return false;
+    }
+  }
+  if (flags["stream"]) {
+    return stream(error, arguments[0], optimizer.get(), timing.get(), *out) &&
+           error->count(fail_level) == 0;
+  }
+
+  // Parse the program
+  parser::ParseOptions parse_options;
+  parse_options.share = flags["share"];
+  parse_options.timing = timing.get();
+  Timing::Phase parse_phase(timing.get(), arguments[0], "parse");
+  auto module = parser::parse(error, arguments[0], parse_options);
+  parse_phase.stop();
+  if (!module) {
+    return false;
+  }
+
+  // Check for correctness, which computes the output of the program
+  vector<int64_t> results;
+  Timing::Phase check_phase(timing.get(), arguments[0], "check");
+  auto checked =
+      checker::check(error, module, flags["image"] ? &results : nullptr);
+  check_phase.stop();
+  if (!checked || error->count(fail_level) > 0) {
+    return false;
+  }
+
+  // Emit LLVM IR code
+  Timing::Phase emit_phase(timing.get(), arguments[0], "emit");
+  llvm::LLVMContext llvm_context;
+  auto llvm_module = new llvm::Module(arguments[0], llvm_context);
+  if (flags["image"]) {
+    emitter::emit_image(llvm_module, results);
+  } else {
+    auto llvm_function = emitter::emit(module, llvm_module, function_size,
+                                       timing.get());
+    if (!llvm_function) {
+      return false;
+    }
+    emitter::emit_runtime(llvm_module);
+  }
+  emit_phase.stop();
+  if (optimizer) {
+    optimizer->optimize(llvm_module);
+  }
+
+  // Write the LLVM IR
+  Timing::Phase print_phase(timing.get(), arguments[0], "print");
   llvm_module->print(*out, nullptr);
+  out->flush();
   return true;
 }
 
@@ -20,7 +20,22 @@ namespace compiler::commands {
 
 Parse::Parse()
     : Command("parse", "Check the syntax of a module",
-              {Option("strict", "Treat warnings as fatal errors")}, "path…") {
+              {Option("strict", "Treat warnings as fatal errors"),
+               Option("jobs",
+                      "Threads to parse with, or 0 for one per core (the "
+                      "default)",
+                      Option::OPTION, "0"),
+               Option("tree", "Build the syntax tree of each file"),
+               Option("parser", "Parser to use with -tree (bison or pratt)",
+                      Option::OPTION),
+               Option("time", "Print the time of each phase to stderr"),
+               Option("time-format", "Format of -time: text or json",
+                      Option::OPTION, "text"),
+               Option("trace",
+                      "Write a timeline of the command to the given path as "
+                      "Chrome trace JSON",
+                      Option::OPTION)},
+              "path…") {
 }
 
 bool Parse::execute(const filesystem::path& executable,
@@ -30,16 +45,30 @@ bool Parse::execute(const filesystem::path& executable,
     print_help(executable);
     return false;
   }
-  auto fail_level = flags["strict"] ? Error::WARNING : Error::ERROR;
-  bool success = true;
-  for (auto& path : arguments) {
-    auto error = make_shared<Error::Terminal>();
-    auto module = parser::parse(error, path);
-    if (!module || error->count(fail_level) > 0) {
-      success = false;
-    }
+  unsigned jobs;
+  parser::ParseOptions parse_options;
+  if (!parse_jobs(options["jobs"], jobs) ||
+      !parse_parser(options["parser"], parse_options.pratt) ||
+      !expand_response_files(arguments)) {
+    return false;
   }
-  return success;
+  auto fail_level = flags["strict"] ? Error::WARNING : Error::ERROR;
+  bool tree = flags["tree"];
+  return process_files(
+      arguments, jobs, fail_level,
+      [tree, parse_options, timing = timing.get()](
+          shared_ptr<Error> error, const filesystem::path& path,
+          unsigned jobs) {
+        Timing::Phase phase(timing, path, "parse");
+        if (!tree) {
+          Timing::Span span(timing, "scan", path);
+          return parser::recognize(error, path);
+        }
+        auto file_options = parse_options;
+        file_options.jobs = jobs;
+        file_options.timing = timing;
+        return parser::parse(error, path, file_options) != nullptr;
+      });
 }
 
 }
@@ -20,80 +20,550 @@
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <thread>
 
 #include "../checker/check.h"
+#include "../checker/evaluate.h"
 #include "../emitter/emit.h"
+#include "../emitter/machine.h"
 #include "../emitter/optimize.h"
 #include "../parser/parse.h"
+#include "../runtime/output.h"
+#include "../vm/program.h"
+#include "color.h"
 
 namespace compiler::commands {
 
 Run::Run()
     : Command("run", "Run a program",
               {Option("strict", "Treat warnings as fatal errors"),
-               Option("unoptimized", "Do not optimize the program")},
+               Option("unoptimized", "Do not optimize the program"),
+               Option("O", "Optimization level: 0, 1, 2, 3, s or z",
+                      Option::OPTION, "3"),
+               Option("passes",
+                      "LLVM pass pipeline to run instead, as in opt -passes",
+                      Option::OPTION),
+               Option("share", "Emit identical subexpressions once"),
+               Option("stream",
+                      "Run expressions as they are parsed in bounded memory"),
+               Option("engine",
+                      "Print values computed by the checker (fold), "
+                      "interpret bytecode (vm), compile with LLVM (jit), or "
+                      "interpret while compiling in the background (tiered)",
+                      Option::OPTION, "fold"),
+               Option("tier-chunk",
+                      "Expressions per chunk compiled in tiered execution",
+                      Option::OPTION, "4096"),
+               Option("function-size",
+                      "Maximum expressions per function we compile",
+                      Option::OPTION, "4096"),
+               Option("cpu",
+                      "Processor to generate code for, or native for this "
+                      "one",
+                      Option::OPTION, "generic"),
+               Option("features",
+                      "Processor features to enable or disable, e.g., "
+                      "+avx2,-bmi2",
+                      Option::OPTION),
+               Option("reloc",
+                      "Relocation model: default, static, pic or "
+                      "dynamic-no-pic",
+                      Option::OPTION, "default"),
+               Option("code-model",
+                      "Code model: default, tiny, small, kernel, medium or "
+                      "large",
+                      Option::OPTION, "default"),
+               Option("verbose", "Print details of execution to stderr"),
+               Option("time", "Print the time of each phase to stderr"),
+               Option("time-format", "Format of -time: text or json",
+                      Option::OPTION, "text"),
+               Option("trace",
+                      "Write a timeline of the command to the given path as "
+                      "Chrome trace JSON",
+                      Option::OPTION)},
               "path") {
 }
 
+// How we execute programs
+enum class Engine {
+  FOLD,
+  VM,
+  JIT,
+  TIERED,
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Returns the number of milliseconds since `start`.
+static double milliseconds_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Sets up the given factory to generate code for the given machine.
+static void configure_engine(llvm::EngineBuilder& factory,
+                             const emitter::MachineOptions& machine) {
+  factory.setMCPU(machine.cpu);
+  factory.setMAttrs(llvm::SubtargetFeatures(machine.features).getFeatures());
+  if (machine.reloc) {
+    factory.setRelocationModel(*machine.reloc);
+  }
+  if (machine.code_model) {
+    factory.setCodeModel(*machine.code_model);
+  }
+}
+
+// Creates a JIT engine that owns the given LLVM module.
+static std::unique_ptr<llvm::ExecutionEngine> create_engine(
+    shared_ptr<Error> error, llvm::Module* llvm_module,
+    const emitter::MachineOptions& machine, bool optimized) {
+  llvm::EngineBuilder factory((std::unique_ptr<llvm::Module>(llvm_module)));
+  configure_engine(factory, machine);
+  if (optimized) {
+    llvm::TargetOptions target_options;
+    std::unique_ptr<llvm::RTDyldMemoryManager> memory_manager(
+        new llvm::SectionMemoryManager());
+    factory.setEngineKind(llvm::EngineKind::JIT)
+        .setTargetOptions(target_options)
+        .setMCJITMemoryManager(std::move(memory_manager));
+  }
+  string llvm_error;
+  std::unique_ptr<llvm::ExecutionEngine> engine(
+      factory.setErrorStr(&llvm_error).create());
+  if (!engine) {
+    error->report(Error::Level::ERROR, llvm_error);
+    return nullptr;
+  }
+  llvm_module->setDataLayout(engine->getDataLayout());
+  return engine;
+}
+
+// Runs the program as it is parsed, compiling and executing expressions in
+// batches with a fresh LLVM context for each batch, so memory use does not
+// grow with the size of the input. We also run a batch whenever we would
+// otherwise wait for more input, so the output of a program read from a pipe
+// keeps up with its input. Other engines do not use LLVM at all, and run each
+// batch as a bytecode program or print each value as soon as the checker
+// computes it. We optimize compiled batches with `optimizer` unless it is
+// null, and generate code for `machine`. Parsing is interleaved with the
+// other phases, so we only add the phases of each batch to `timing`, if it
+// is not null.
+static bool stream(shared_ptr<Error> error, const filesystem::path& path,
+                   Engine engine_kind, emitter::Optimizer* optimizer,
+                   const emitter::MachineOptions& machine, Timing* timing) {
+  vm::Program program;
+  std::unique_ptr<llvm::ExecutionEngine> engine;
+  vector<int64_t> values;
+  bool success = true;
+  auto name = path.string();
+
+  emitter::BatchEmitter batches(
+      [&](llvm::LLVMContext& context, const string& function) {
+        auto llvm_module = new llvm::Module(name, context);
+        engine = create_engine(error, llvm_module, machine,
+                               optimizer != nullptr);
+        return engine ? llvm_module : nullptr;
+      },
+      [&](llvm::Module* llvm_module, llvm::Function* function) {
+        if (optimizer) {
+          optimizer->optimize(llvm_module);
+        }
+        Timing::Phase codegen_phase(timing, name, "codegen");
+        engine->finalizeObject();
+        codegen_phase.stop();
+        Timing::Phase run_phase(timing, name, "run");
+        engine->runFunction(function, {});
+        runtime::flush();
+        run_phase.stop();
+        engine.reset();
+      },
+      name, timing);
+
+  auto parsed = parser::parse(
+      error, path,
+      [&](const parser::NodeTable& nodes, parser::NodeTable::Index expression,
+          bool input_pending) {
+        if (!success) {
+          return;
+        }
+        Timing::Phase check_phase(timing, name, "check", false);
+        if (!checker::evaluate(error, nodes, values)) {
+          success = false;
+          return;
+        }
+        check_phase.stop();
+        Timing::Phase run_phase(timing, name, "run", false);
+        if (engine_kind == Engine::FOLD) {
+          runtime::print(values[expression]);
+          if (!input_pending) {
+            runtime::flush();
+          }
+          return;
+        } else if (engine_kind == Engine::VM) {
+          program.add(nodes, expression);
+          if (program.size() >= emitter::BatchEmitter::batch_size ||
+              !input_pending) {
+            Timing::Span span(timing, "run batch", name);
+            program.run();
+            program.clear();
+            runtime::flush();
+          }
+          return;
+        }
+        run_phase.stop();
+        success = batches.add(nodes, expression, !input_pending);
+      });
+  Timing::Phase run_phase(timing, name, "run");
+  program.run();
+  run_phase.stop();
+  batches.finish();
+  runtime::flush();
+  return parsed && success;
+}
+
+// A chunk of a program compiled to native code for tiered execution
+struct NativeChunk {
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::unique_ptr<llvm::ExecutionEngine> engine;
+  llvm::Function* function;
+};
+
+// Runs the program in chunks of `chunk_size` top-level expressions. We start
+// with the bytecode interpreter right away, while a background thread
+// compiles chunks with LLVM, and run each chunk as native code if it has
+// been compiled by the time we reach it. The compiler skips ahead of the
+// chunk we are running by as many chunks as we ran while it compiled its
+// last chunk, so it rarely compiles a chunk we have already run. Each chunk
+// has its own LLVM context and engine, so we can run one while another is
+// compiled. Only the background thread uses `optimizer`, if it is not null,
+// and it generates code for `machine`. If `verbose` is true, we report each
+// switch between tiers and the time spent in each tier. If `timing` is not
+// null, we add the phases of both threads to it.
+static bool run_tiered(shared_ptr<Error> error,
+                       shared_ptr<parser::Module> module,
+                       emitter::Optimizer* optimizer,
+                       const emitter::MachineOptions& machine,
+                       size_t chunk_size, bool verbose, Timing* timing) {
+  auto start = Clock::now();
+  auto& expressions = module->expressions;
+  size_t count = (expressions.size() + chunk_size - 1) / chunk_size;
+  vector<std::unique_ptr<NativeChunk>> native(count);
+  std::mutex mutex;
+  std::atomic<size_t> running(0);
+  std::atomic<bool> finished(false);
+
+  // The background compiler
+  auto compile_error = make_shared<Error::Buffer>();
+  size_t compiled = 0;
+  double compile_time = 0;
+  std::thread compiler([&]() {
+    size_t lookahead = 1;
+    for (size_t next = 1; !finished; next++) {
+      size_t position = running;
+      next = std::max(next, position + lookahead);
+      if (next >= count) {
+        break;
+      }
+      auto chunk_start = Clock::now();
+      Timing::Span span(timing, "compile chunk", std::to_string(next));
+      Timing::Phase emit_phase(timing, module->path, "emit");
+      auto chunk = std::make_unique<NativeChunk>();
+      chunk->context = std::make_unique<llvm::LLVMContext>();
+      auto llvm_module = new llvm::Module(module->path.string(),
+                                          *chunk->context);
+      chunk->engine =
+          create_engine(compile_error, llvm_module, machine,
+                        optimizer != nullptr);
+      if (!chunk->engine) {
+        break;
+      }
+      emitter::FunctionEmitter function_emitter(llvm_module, "main");
+      auto end = std::min((next + 1) * chunk_size, expressions.size());
+      for (auto i = next * chunk_size; i < end; i++) {
+        function_emitter.add(module->nodes, expressions[i]);
+      }
+      chunk->function = function_emitter.finish();
+      emit_phase.stop();
+      if (optimizer) {
+        optimizer->optimize(llvm_module);
+      }
+      Timing::Phase codegen_phase(timing, module->path, "codegen");
+      chunk->engine->finalizeObject();
+      codegen_phase.stop();
+      compile_time += milliseconds_since(chunk_start);
+      compiled++;
+
+      // Aim as far ahead as the interpreter got while we compiled this chunk
+      lookahead = running - position + 1;
+      std::lock_guard<std::mutex> lock(mutex);
+      native[next] = std::move(chunk);
+    }
+  });
+
+  // Run each chunk in the fastest tier available
+  Timing::Phase run_phase(timing, module->path, "run");
+  vm::Program program;
+  size_t tier_chunks[2] = {0, 0};
+  double tier_time[2] = {0, 0};
+  bool was_native = false;
+  for (size_t i = 0; i < count; i++) {
+    running = i;
+    std::unique_ptr<NativeChunk> chunk;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      chunk = std::move(native[i]);
+    }
+    auto begin = i * chunk_size;
+    bool is_native = chunk != nullptr;
+    if (verbose && is_native != was_native) {
+      std::cerr << "Switched to " << (is_native ? "jit" : "vm")
+                << " at expression " << begin << " after " << std::fixed
+                << std::setprecision(1) << milliseconds_since(start) << " ms"
+                << std::endl;
+    }
+    was_native = is_native;
+    auto chunk_start = Clock::now();
+    Timing::Span span(timing, is_native ? "run jit chunk" : "run vm chunk",
+                      std::to_string(i));
+    if (is_native) {
+      chunk->engine->runFunction(chunk->function, {});
+    } else {
+      auto end = std::min(begin + chunk_size, expressions.size());
+      for (auto j = begin; j < end; j++) {
+        program.add(module->nodes, expressions[j]);
+      }
+      program.run();
+    }
+    tier_time[is_native] += milliseconds_since(chunk_start);
+    tier_chunks[is_native]++;
+  }
+  runtime::flush();
+  run_phase.stop();
+  finished = true;
+  compiler.join();
+  compile_error->flush(*error);
+
+  if (verbose) {
+    std::cerr << std::fixed << std::setprecision(1) << "Ran "
+              << tier_chunks[0] << " chunks in vm in " << tier_time[0]
+              << " ms and " << tier_chunks[1] << " chunks in jit in "
+              << tier_time[1] << " ms" << std::endl
+              << "Compiled " << compiled << " chunks in " << compile_time
+              << " ms on a background thread, " << compiled - tier_chunks[1]
+              << " too late to run" << std::endl;
+  }
+  return compile_error->count(Error::ERROR) == 0;
+}
+
 bool Run::execute(const filesystem::path& executable, map<string, bool>& flags,
                   map<string, string>& options, vector<string>& arguments) {
   if (arguments.size() < 1) {
     print_help(executable);
     return false;
   }
+  Engine engine_kind;
+  auto& engine_name = options["engine"];
+  if (engine_name == "fold") {
+    engine_kind = Engine::FOLD;
+  } else if (engine_name == "vm") {
+    engine_kind = Engine::VM;
+  } else if (engine_name == "jit") {
+    engine_kind = Engine::JIT;
+  } else if (engine_name == "tiered") {
+    engine_kind = Engine::TIERED;
+  } else {
+    Color color(isatty(STDERR_FILENO));
+    std::cerr << "Option " << color.error("engine")
+              << " requires fold, vm, jit or tiered" << std::endl;
+    return false;
+  }
+  size_t chunk_size, function_size, level;
+  emitter::MachineOptions machine;
+  if (!parse_count("tier-chunk", options["tier-chunk"], chunk_size) ||
+      !parse_count("function-size", options["function-size"], function_size) ||
+      !parse_choice("O", options["O"], {"0", "1", "2", "3", "s", "z"},
+                    level) ||
+      !parse_machine(options, machine)) {
+    return false;
+  }
+  emitter::OptimizeOptions optimize_options;
+  optimize_options.level = static_cast<emitter::OptimizationLevel>(level);
+  optimize_options.passes = options["passes"];
+  optimize_options.timing = timing.get();
 
-  // Initialize LLVM
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
+  // Initialize LLVM only if we use it, since that dominates the run time of
+  // short programs. Compiled code prints with our runtime rather than its
+  // own, so its output is ordered with the output of the interpreter.
+  if (engine_kind == Engine::JIT || engine_kind == Engine::TIERED) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::sys::DynamicLibrary::AddSymbol(
+        emitter::print_function, reinterpret_cast<void*>(&runtime::print));
+    if (flags["time"]) {
+      emitter::time_code_generation(timing.get());
+    }
+  }
 
-  // Parse the program
   auto error = make_shared<Error::Terminal>();
   auto fail_level = flags["strict"] ? Error::WARNING : Error::ERROR;
-  auto module = parser::parse(error, arguments[0]);
+  if (flags["stream"] && engine_kind == Engine::TIERED) {
+    error->report(Error::ERROR,
+                  "-stream cannot be combined with -engine=tiered");
+    return false;
+  }
+
+  // The JIT generates code for the processor we run on, unless we are told
+  // otherwise
+  if (engine_kind == Engine::JIT || engine_kind == Engine::TIERED) {
+    auto triple = llvm::sys::getProcessTriple();
+    string llvm_error;
+    auto llvm_target = llvm::TargetRegistry::lookupTarget(triple, llvm_error);
+    if (!llvm_target) {
+      error->report(Error::ERROR, llvm_error);
+      return false;
+    }
+    if (!emitter::resolve_machine(error, llvm_target, triple, machine)) {
+      return false;
+    }
+    if (flags["verbose"]) {
+      llvm::EngineBuilder factory;
+      configure_engine(factory, machine);
+      std::unique_ptr<llvm::TargetMachine> llvm_machine(
+          factory.selectTarget());
+      std::cerr << emitter::describe_machine(llvm_machine.get()) << std::endl;
+    }
+  } else {
+    // The other engines generate no machine code, so options that describe
+    // the machine have no effect
+    emitter::MachineOptions defaults;
+    vector<string> ignored;
+    if (machine.cpu != defaults.cpu) {
+      ignored.push_back("-cpu");
+    }
+    if (machine.features != defaults.features) {
+      ignored.push_back("-features");
+    }
+    if (machine.reloc) {
+      ignored.push_back("-reloc");
+    }
+    if (machine.code_model) {
+      ignored.push_back("-code-model");
+    }
+    if (!ignored.empty()) {
+      string names;
+      for (size_t i = 0; i < ignored.size(); i++) {
+        if (i > 0) {
+          names += i + 1 < ignored.size() ? ", " : " and ";
+        }
+        names += ignored[i];
+      }
+      error->report(Error::WARNING,
+                    names + (ignored.size() > 1 ? " have" : " has") +
+                        " no effect with -engine=" + options["engine"] +
+                        ", which generates no machine code");
+    }
+    if (flags["verbose"]) {
+      std::cerr << "No machine code: -engine=" << options["engine"]
+                << " does not compile the program" << std::endl;
+    }
+  }
+
+  // Build the optimization pipeline once for all of the modules we compile
+  std::unique_ptr<emitter::Optimizer> optimizer;
+  if ((engine_kind == Engine::JIT || engine_kind == Engine::TIERED) &&
+      !flags["unoptimized"]) {
+    optimizer = emitter::Optimizer::create(error, optimize_options);
+    if (!optimizer) {
+      return false;
+    }
+  }
+  if (flags["stream"]) {
+    return stream(error, arguments[0], engine_kind, optimizer.get(), machine,
+                  timing.get()) &&
+           error->count(fail_level) == 0;
+  }
+
+  // Parse the program
+  parser::ParseOptions parse_options;
+  parse_options.share = flags["share"];
+  parse_options.timing = timing.get();
+  Timing::Phase parse_phase(timing.get(), arguments[0], "parse");
+  auto module = parser::parse(error, arguments[0], parse_options);
+  parse_phase.stop();
   if (!module) {
     return false;
   }
 
-  // Check for correctness
-  auto symbols = checker::check(error, module);
-  if (!symbols || error->count(fail_level) > 0) {
+  // Check for correctness, which computes the value of every expression
+  vector<int64_t> results;
+  Timing::Phase check_phase(timing.get(), arguments[0], "check");
+  auto checked = checker::check(
+      error, module, engine_kind == Engine::FOLD ? &results : nullptr);
+  check_phase.stop();
+  if (!checked || error->count(fail_level) > 0) {
     return false;
   }
+  if (engine_kind == Engine::FOLD) {
+    Timing::Phase run_phase(timing.get(), arguments[0], "run");
+    for (auto value : results) {
+      runtime::print(value);
+    }
+    runtime::flush();
+    return true;
+  } else if (engine_kind == Engine::VM) {
+    Timing::Phase run_phase(timing.get(), arguments[0], "run");
+    vm::Program program;
+    for (auto expression : module->expressions) {
+      program.add(module->nodes, expression);
+    }
+    program.run();
+    runtime::flush();
+    return true;
+  } else if (engine_kind == Engine::TIERED) {
+    return run_tiered(error, module, optimizer.get(), machine, chunk_size,
+                      flags["verbose"], timing.get());
+  }
 
   // Set up the LLVM JIT engine
+  Timing::Phase emit_phase(timing.get(), arguments[0], "emit");
   llvm::LLVMContext llvm_context;
   auto llvm_module = new llvm::Module(arguments[0], llvm_context);
-  llvm::EngineBuilder factory((std::unique_ptr<llvm::Module>(llvm_module)));
-  if (!flags["unoptimized"]) {
-    llvm::TargetOptions target_options;
-    std::unique_ptr<llvm::RTDyldMemoryManager> memory_manager(
-        new llvm::SectionMemoryManager());
-    factory.setEngineKind(llvm::EngineKind::JIT)
-        .setTargetOptions(target_options)
-        .setMCJITMemoryManager(std::move(memory_manager));
-  }
-  string llvm_error;
-  auto engine = factory.setErrorStr(&llvm_error).create();
+  auto engine =
+      create_engine(error, llvm_module, machine, optimizer != nullptr);
   if (!engine) {
-    error->report(Error::Level::ERROR, llvm_error);
     return false;
   }
-  llvm_module->setDataLayout(engine->getDataLayout());
 
   // Emit LLVM IR code
-  auto llvm_function = emitter::emit(module, llvm_module);
+  auto llvm_function = emitter::emit(module, llvm_module, function_size,
+                                     timing.get());
   if (!llvm_function) {
     return false;
   }
-  if (!flags["unoptimized"]) {
-    emitter::optimize(llvm_module);
+  emit_phase.stop();
+  if (optimizer) {
+    optimizer->optimize(llvm_module);
   }
 
   // Run the program
+  Timing::Phase codegen_phase(timing.get(), arguments[0], "codegen");
   engine->finalizeObject();
+  codegen_phase.stop();
+  Timing::Phase run_phase(timing.get(), arguments[0], "run");
   engine->runFunction(llvm_function, {});
+  runtime::flush();
   return true;
 }
 
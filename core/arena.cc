@@ -0,0 +1,51 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+namespace compiler {
+
+// The size of the blocks we request from the heap. Larger allocations get a
+// dedicated block of their own.
+static const size_t block_size = 64 * 1024;
+
+Arena::~Arena() {
+  for (auto i = destructors_.rbegin(); i != destructors_.rend(); ++i) {
+    i->destroy(i->object);
+  }
+  for (auto block : blocks_) {
+    free(block);
+  }
+}
+
+void* Arena::allocate_block(size_t size, size_t alignment) {
+  auto padded_size = size + alignment - 1;
+  auto block = static_cast<char*>(malloc(std::max(padded_size, block_size)));
+  if (!block) {
+    throw std::bad_alloc();
+  }
+  blocks_.push_back(block);
+  auto address = reinterpret_cast<uintptr_t>(block);
+  auto aligned = (address + alignment - 1) & ~(alignment - 1);
+  if (padded_size < block_size) {
+    next_ = reinterpret_cast<char*>(aligned + size);
+    end_ = block + block_size;
+  }
+  return reinterpret_cast<void*>(aligned);
+}
+
+}
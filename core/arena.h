@@ -0,0 +1,82 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <new>
+#include <stdint.h>
+#include <type_traits>
+
+#include "common.h"
+
+namespace compiler {
+
+// A bump allocator that owns every object created in it. Objects are carved
+// out of large blocks and are never freed individually; the blocks are
+// released all at once when the arena is destroyed. Trivially destructible
+// objects cost nothing to tear down, and we keep a flat list of destructors
+// for the rest so destruction never recurses.
+class Arena {
+ public:
+  Arena() {
+  }
+
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Constructs a new object of type T in this arena.
+  template <typename T, typename... Args>
+  T* create(Args&&... args) {
+    auto object =
+        new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      destructors_.push_back(
+          {object, [](void* object) { static_cast<T*>(object)->~T(); }});
+    }
+    return object;
+  }
+
+  // Returns uninitialized memory with the given size and alignment.
+  inline void* allocate(size_t size, size_t alignment) {
+    auto address = reinterpret_cast<uintptr_t>(next_);
+    auto aligned = (address + alignment - 1) & ~(alignment - 1);
+    if (!next_ || aligned + size > reinterpret_cast<uintptr_t>(end_)) {
+      return allocate_block(size, alignment);
+    }
+    next_ = reinterpret_cast<char*>(aligned + size);
+    return reinterpret_cast<void*>(aligned);
+  }
+
+  // The number of blocks this arena has requested from the heap.
+  inline size_t block_count() const {
+    return blocks_.size();
+  }
+
+ private:
+  struct Destructor {
+    void* object;
+    void (*destroy)(void*);
+  };
+
+  void* allocate_block(size_t size, size_t alignment);
+
+  char* next_ = nullptr;
+  char* end_ = nullptr;
+  vector<char*> blocks_;
+  vector<Destructor> destructors_;
+};
+
+}
@@ -22,6 +22,8 @@
 #include <unistd.h>
 #include <utf8.h>
 
+#include "source.h"
+
 namespace compiler {
 
 namespace {
@@ -72,44 +74,48 @@ static string line_number_prefix(int line_number, string prefix = "",
 
 // Displays the given message in color in addition to printing an excerpt of
 // the given file at the given location, highlighting the erroneous segment.
-static void display_tty_error(Error::Level level, Location location,
+// If `text` is not null, it is the contents of the file, which are not on
+// disk, e.g., a buffer from an editor.
+static void display_tty_error(Error::Level level,
+                              const filesystem::path& path, const string* text,
+                              const Position& first, const Position& last,
                               const string& message) {
   // Display the error message
   Color color(level);
   std::error_code error;
-  std::cerr << color.underline(
-                   filesystem::proximate(*location.begin.path, error).string() +
-                   ":" + std::to_string(location.begin.line))
+  std::cerr << color.underline(filesystem::proximate(path, error).string() +
+                               ":" + std::to_string(first.line))
             << color.colorful(" · " + message) << std::endl;
 
   // Don't try to display context for special paths like /dev/stdin.
-  if (!filesystem::is_regular_file(*location.begin.path)) {
+  std::unique_ptr<std::istream> file;
+  if (text) {
+    file = std::make_unique<std::istringstream>(*text);
+  } else if (filesystem::is_regular_file(path)) {
+    file = std::make_unique<std::ifstream>(path);
+  } else {
     return;
   }
 
   // Attempt to show an excerpt of the file and highlight the error
   static const size_t excerpt_window = 2;
-  std::ifstream file(*location.begin.path);
   size_t line_number = 0;
   bool printed_excerpt = false;
   string line;
-  while (std::getline(file, line)) {
+  while (std::getline(*file, line)) {
     line_number++;
-    if (line_number == location.begin.line) {
+    if (line_number == first.line) {
       if (!printed_excerpt) {
         std::cerr << std::endl;
         printed_excerpt = true;
       }
       std::cerr << line_number_prefix(line_number, color.bold("→ "), 2);
       size_t line_length = utf8::distance(line.begin(), line.end());
-      if (location.end.line > location.begin.line ||
-          line_length >= location.end.column) {
+      if (last.line > first.line || line_length >= last.column) {
         // Highlight the erroneous segment of the line in color
-        auto end_column = location.end.line > location.begin.line ?
-                              line_length :
-                              location.end.column;
+        auto end_column = last.line > first.line ? line_length : last.column;
         auto start = line.begin();
-        utf8::advance(start, location.begin.column - 1, line.end());
+        utf8::advance(start, first.column - 1, line.end());
         auto end = line.begin();
         utf8::advance(end, end_column, line.end());
         std::cerr << string(line.begin(), start)
@@ -118,15 +124,15 @@ static void display_tty_error(Error::Level level, Location location,
       } else {
         std::cerr << line << std::endl;
       }
-    } else if (line_number + excerpt_window >= location.begin.line &&
-               line_number <= location.begin.line + excerpt_window) {
+    } else if (line_number + excerpt_window >= first.line &&
+               line_number <= first.line + excerpt_window) {
       if (!printed_excerpt) {
         std::cerr << std::endl;
         printed_excerpt = true;
       }
       std::cerr << line_number_prefix(line_number) << color.light(line)
                 << std::endl;
-      if (location.begin.line + excerpt_window == line_number) {
+      if (first.line + excerpt_window == line_number) {
         break;
       }
     }
@@ -157,18 +163,26 @@ void Error::report(Error::Level level, const string& message) {
 
 void Error::Terminal::display(Error::Level level, Location location,
                               const string& message) {
-  assert(location.begin.path);
+  assert(location.file);
   if (min_level_ == ERROR && level == WARNING) {
     return;
   }
+  auto& sources = SourceManager::shared();
+  auto path = sources.path(location.file);
+  auto first = sources.position(location.file, location.begin);
   if (isatty(STDERR_FILENO)) {
-    display_tty_error(level, location, message);
+    // The end position is inclusive, i.e., the column of the last character
+    auto last = location.length > 0 ?
+                    sources.position(location.file, location.end() - 1) :
+                    first;
+    auto text = sources.text(location.file);
+    display_tty_error(level, path, text.get(), first, last, message);
   } else {
     std::error_code error;
     auto prefix = level == WARNING ? "Warning" : "Error";
     std::cerr << prefix << ": "
-              << filesystem::proximate(*location.begin.path, error).string()
-              << ":" << location.begin.line << ": " << message << std::endl;
+              << filesystem::proximate(path, error).string() << ":"
+              << first.line << ": " << message << std::endl;
   }
 }
 
@@ -187,4 +201,23 @@ void Error::Terminal::display(Error::Level level, const string& message) {
   }
 }
 
+void Error::Buffer::flush(Error& error) const {
+  for (auto& entry : entries_) {
+    if (entry.has_location) {
+      error.report(entry.level, entry.location, entry.message);
+    } else {
+      error.report(entry.level, entry.message);
+    }
+  }
+}
+
+void Error::Buffer::display(Error::Level level, Location location,
+                            const string& message) {
+  entries_.push_back(Entry{level, true, location, message});
+}
+
+void Error::Buffer::display(Error::Level level, const string& message) {
+  entries_.push_back(Entry{level, false, Location(), message});
+}
+
 }
@@ -24,6 +24,7 @@ namespace compiler {
 // errors at different phases of compilation.
 class Error {
  public:
+  class Buffer;
   class Terminal;
 
   enum Level {
@@ -71,4 +72,28 @@ class Error::Terminal : public Error {
   Level min_level_;
 };
 
+// An implementation of Error that records errors so they can be reported
+// later, e.g., to display the errors from concurrent tasks in a deterministic
+// order.
+class Error::Buffer : public Error {
+ public:
+  // Reports the recorded errors to the given Error in the order they were
+  // reported to us.
+  void flush(Error& error) const;
+
+ protected:
+  void display(Level level, Location location, const string& message) override;
+  void display(Level level, const string& message) override;
+
+ private:
+  struct Entry {
+    Level level;
+    bool has_location;
+    Location location;
+    string message;
+  };
+
+  vector<Entry> entries_;
+};
+
 };
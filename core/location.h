@@ -14,21 +14,45 @@
 
 #pragma once
 
+#include <algorithm>
+#include <stdint.h>
+
 #include "common.h"
 
 namespace compiler {
 
-// A position within a source file.
+// Identifies a source file registered with the SourceManager. Zero is never
+// assigned to a file.
+using FileID = uint32_t;
+
+// A line and column within a source file. We only compute these when we
+// need to display a diagnostic; see SourceManager::position.
 struct Position {
-  shared_ptr<filesystem::path> path;
   size_t line = 1;
   size_t column = 1;
 };
 
-// The location of a sequence of characters in a source file.
+// The location of a sequence of characters in a source file, as a range of
+// byte offsets.
 struct Location {
-  Position begin;
-  Position end;
+  // The offset of the first byte.
+  uint64_t begin = 0;
+
+  // The number of bytes in the range.
+  uint32_t length = 0;
+
+  FileID file = 0;
+
+  // The offset one past the last byte.
+  inline uint64_t end() const {
+    return begin + length;
+  }
+
+  // Returns the location from the start of `first` to the end of `last`.
+  static inline Location span(const Location& first, const Location& last) {
+    auto length = std::min<uint64_t>(last.end() - first.begin, UINT32_MAX);
+    return Location{first.begin, uint32_t(length), first.file};
+  }
 };
 
 }
@@ -0,0 +1,217 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "source.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace compiler {
+
+// Appends the offset of each line that starts within the given data, which
+// begins at `offset` in its file.
+static void add_line_starts(vector<uint64_t>& line_starts, uint64_t offset,
+                            const char* data, size_t size) {
+  auto end = data + size;
+  auto p = data;
+  while ((p = static_cast<const char*>(memchr(p, '\n', end - p)))) {
+    p++;
+    line_starts.push_back(offset + (p - data));
+  }
+}
+
+Source::Source(const filesystem::path& path, FileID file)
+    : path(path),
+      fd_(-1),
+      data_(nullptr),
+      size_(0),
+      offset_(0),
+      failed_(false),
+      owns_data_(true),
+      line_starts_(nullptr) {
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ == -1) {
+    return;
+  }
+
+  // Map regular files into memory. Empty files cannot be mapped, but they
+  // have nothing to read anyway. The mapping outlives the file descriptor,
+  // so we close it right away.
+  struct stat info;
+  if (fstat(fd_, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    auto data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, info.st_size, MADV_SEQUENTIAL);
+      data_ = static_cast<char*>(data);
+      size_ = info.st_size;
+      close(fd_);
+      fd_ = -1;
+      return;
+    }
+  }
+  if (file) {
+    auto& record = SourceManager::shared().get(file);
+    record.streamed = true;
+    line_starts_ = &record.line_starts;
+  }
+}
+
+Source::Source(const filesystem::path& path, const char* data, size_t size)
+    : path(path),
+      fd_(-1),
+      data_(const_cast<char*>(data)),
+      size_(size),
+      offset_(0),
+      failed_(false),
+      owns_data_(false),
+      line_starts_(nullptr) {
+}
+
+Source::~Source() {
+  if (data_ && owns_data_) {
+    munmap(data_, size_);
+  }
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+size_t Source::read(char* buffer, size_t size) {
+  if (data_) {
+    auto count = std::min(size, size_ - offset_);
+    memcpy(buffer, data_ + offset_, count);
+    offset_ += count;
+    return count;
+  }
+  while (true) {
+    auto count = ::read(fd_, buffer, size);
+    if (count >= 0) {
+      if (line_starts_) {
+        add_line_starts(*line_starts_, offset_, buffer, count);
+      }
+      offset_ += count;
+      return count;
+    } else if (errno != EINTR) {
+      failed_ = true;
+      return 0;
+    }
+  }
+}
+
+bool Source::ready() const {
+  if (data_ || fd_ == -1) {
+    return true;
+  }
+  struct pollfd request = {.fd = fd_, .events = POLLIN};
+  return poll(&request, 1, 0) != 0;
+}
+
+SourceManager& SourceManager::shared() {
+  static SourceManager manager;
+  return manager;
+}
+
+FileID SourceManager::add(const filesystem::path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  files_.emplace_back();
+  files_.back().path = path;
+  return files_.size();
+}
+
+FileID SourceManager::add(const filesystem::path& path,
+                          shared_ptr<const string> text) {
+  vector<uint64_t> line_starts{0};
+  add_line_starts(line_starts, 0, text->data(), text->size());
+  std::lock_guard<std::mutex> lock(mutex_);
+  files_.emplace_back();
+  files_.back().path = path;
+  files_.back().streamed = true;
+  files_.back().line_starts = std::move(line_starts);
+  files_.back().text = std::move(text);
+  return files_.size();
+}
+
+void SourceManager::update(FileID file, shared_ptr<const string> text) {
+  vector<uint64_t> line_starts{0};
+  add_line_starts(line_starts, 0, text->data(), text->size());
+  auto& record = get(file);
+  std::lock_guard<std::mutex> lock(mutex_);
+  assert(record.text);
+  record.line_starts = std::move(line_starts);
+  record.text = std::move(text);
+}
+
+SourceManager::File& SourceManager::get(FileID file) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return files_.at(file - 1);
+}
+
+filesystem::path SourceManager::path(FileID file) {
+  return get(file).path;
+}
+
+shared_ptr<const string> SourceManager::text(FileID file) {
+  auto& record = get(file);
+  std::lock_guard<std::mutex> lock(mutex_);
+  return record.text;
+}
+
+Position SourceManager::position(FileID file, uint64_t offset) {
+  auto& record = get(file);
+  std::call_once(record.indexed, [&record]() {
+    if (record.streamed) {
+      return;
+    }
+    Source source(record.path);
+    if (source.is_mapped()) {
+      add_line_starts(record.line_starts, 0, source.data(), source.size());
+    }
+  });
+
+  // Non-ASCII characters can only appear in comments, which run to the end
+  // of their line, so byte columns match character columns for every token.
+  auto& line_starts = record.line_starts;
+  auto line = std::upper_bound(line_starts.begin(), line_starts.end(), offset);
+  if (line == line_starts.begin()) {
+    return Position{record.first_line, 1};
+  }
+  return Position{record.first_line + (line - line_starts.begin()) - 1,
+                  size_t(offset - *(line - 1) + 1)};
+}
+
+void SourceManager::release(FileID file, uint64_t offset) {
+  auto& record = get(file);
+  if (!record.streamed) {
+    return;
+  }
+
+  // Erasing from the front of the vector is linear in the lines we keep, so
+  // we wait until there are at least as many lines to discard.
+  auto& line_starts = record.line_starts;
+  auto line = std::upper_bound(line_starts.begin(), line_starts.end(), offset);
+  size_t count = line - line_starts.begin();
+  if (count > 1 && count - 1 >= line_starts.size() - count) {
+    line_starts.erase(line_starts.begin(), line - 1);
+    record.first_line += count - 1;
+  }
+}
+
+}
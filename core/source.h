@@ -0,0 +1,155 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+
+#include "common.h"
+#include "location.h"
+
+namespace compiler {
+
+// The contents of a source file. Regular files are memory mapped in their
+// entirety, so scanners can read the bytes in place. Pipes and special files
+// like /dev/stdin cannot be mapped, so we read them incrementally from the
+// file descriptor instead.
+class Source {
+ public:
+  // If `file` is given and the source cannot be mapped, we record the offsets
+  // of the lines we read with the SourceManager, since we will not be able
+  // to read them again to display diagnostics.
+  Source(const filesystem::path& path, FileID file = 0);
+
+  // Creates a source that reads the given bytes in place, e.g., a range of
+  // another mapped source or text held in memory. The bytes must outlive the
+  // Source.
+  Source(const filesystem::path& path, const char* data, size_t size);
+
+  ~Source();
+
+  Source(const Source&) = delete;
+  Source& operator=(const Source&) = delete;
+
+  // Returns true if the file was opened successfully.
+  inline bool is_open() const {
+    return fd_ != -1 || data_;
+  }
+
+  // Returns true if the entire file is available via data() and size().
+  inline bool is_mapped() const {
+    return data_ != nullptr;
+  }
+
+  // Returns true if a read from a streaming source failed.
+  inline bool failed() const {
+    return failed_;
+  }
+
+  // The mapped contents of the file. Only valid if is_mapped() is true.
+  inline const char* data() const {
+    return data_;
+  }
+
+  inline size_t size() const {
+    return size_;
+  }
+
+  // Copies up to `size` bytes of unread input to the given buffer, returning
+  // the number of bytes copied, or zero at the end of the input.
+  size_t read(char* buffer, size_t size);
+
+  // Returns true if read() can return more input without blocking.
+  bool ready() const;
+
+  filesystem::path path;
+
+ private:
+  int fd_;
+  char* data_;
+  size_t size_;
+  size_t offset_;
+  bool failed_;
+  bool owns_data_;
+  vector<uint64_t>* line_starts_;
+};
+
+// Assigns compact 32-bit IDs to source files, and computes line and column
+// numbers from byte offsets for diagnostics. We index the lines of each
+// file the first time a diagnostic needs them, so scanning and parsing never
+// pay for line and column tracking.
+class SourceManager {
+ public:
+  // The source manager shared by the whole process. It is thread-safe.
+  static SourceManager& shared();
+
+  // Registers the file at the given path, returning its new ID.
+  FileID add(const filesystem::path& path);
+
+  // Registers a version of the file at the given path whose contents are not
+  // on disk, e.g., text from an editor. Diagnostics show excerpts of this
+  // text rather than of the file on disk.
+  FileID add(const filesystem::path& path, shared_ptr<const string> text);
+
+  // Replaces the text of a file registered with add(path, text), e.g., with
+  // the next version from an editor, so successive versions share a single
+  // file. Locations in earlier versions resolve against the new text. This
+  // must not run concurrently with diagnostics for the file.
+  void update(FileID file, shared_ptr<const string> text);
+
+  // Returns the path of the given file.
+  filesystem::path path(FileID file);
+
+  // Returns the text of a file registered with add(path, text), or null if
+  // the file is read from disk.
+  shared_ptr<const string> text(FileID file);
+
+  // Returns the line and column of the byte at the given offset.
+  Position position(FileID file, uint64_t offset);
+
+  // Discards the line offsets recorded for a streamed file before the line
+  // that contains the given offset, once no diagnostic can refer to those
+  // lines anymore, so memory use does not grow with the size of the input.
+  // Positions before that line are no longer available.
+  void release(FileID file, uint64_t offset);
+
+ private:
+  friend class Source;
+
+  struct File {
+    filesystem::path path;
+
+    // True if the file is read from a pipe or other special file, or from
+    // memory. Streamed files record their line offsets as they are read
+    // instead of being indexed on demand.
+    bool streamed = false;
+
+    // The offset of the first byte of each line, starting with the line
+    // numbered `first_line`.
+    vector<uint64_t> line_starts{0};
+    size_t first_line = 1;
+    std::once_flag indexed;
+
+    // The contents of a file that is not on disk.
+    shared_ptr<const string> text;
+  };
+
+  File& get(FileID file);
+
+  std::mutex mutex_;
+  std::deque<File> files_;
+};
+
+}
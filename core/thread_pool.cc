@@ -0,0 +1,127 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace compiler {
+
+ThreadPool::ThreadPool(unsigned threads) {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  size_ = threads;
+  queues_.reset(new Queue[threads]);
+  for (unsigned i = 1; i < threads; i++) {
+    threads_.emplace_back([this, i]() { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  started_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)>& task) {
+  if (count == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    remaining_ = count;
+    for (unsigned i = 0; i < size_; i++) {
+      std::lock_guard<std::mutex> queue_lock(queues_[i].mutex);
+      queues_[i].begin = count * i / size_;
+      queues_[i].end = count * (i + 1) / size_;
+    }
+    generation_++;
+  }
+  started_.notify_all();
+
+  // The calling thread works on the batch too
+  drain(0);
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_.wait(lock, [this]() { return remaining_ == 0; });
+  task_ = nullptr;
+}
+
+void ThreadPool::work(unsigned index) {
+  size_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      started_.wait(lock, [this, generation]() {
+        return stopping_ || generation_ != generation;
+      });
+      if (stopping_) {
+        return;
+      }
+      generation = generation_;
+    }
+    drain(index);
+  }
+}
+
+void ThreadPool::drain(unsigned index) {
+  size_t task;
+  while (next(index, task)) {
+    (*task_)(task);
+    if (--remaining_ == 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finished_.notify_all();
+    }
+  }
+}
+
+// Takes the next task from the front of our own queue, or steals the back
+// half of another thread's queue if ours is empty.
+bool ThreadPool::next(unsigned index, size_t& task) {
+  auto& queue = queues_[index];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.begin < queue.end) {
+      task = queue.begin++;
+      return true;
+    }
+  }
+  for (unsigned i = 1; i < size_; i++) {
+    auto& victim = queues_[(index + i) % size_];
+    size_t begin, end;
+    {
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.begin == victim.end) {
+        continue;
+      }
+      end = victim.end;
+      begin = victim.end - (victim.end - victim.begin + 1) / 2;
+      victim.end = begin;
+    }
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.begin = begin + 1;
+    queue.end = end;
+    task = begin;
+    return true;
+  }
+  return false;
+}
+
+}
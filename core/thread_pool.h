@@ -0,0 +1,75 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+
+namespace compiler {
+
+// A fixed set of threads that run batches of independent tasks. Each thread
+// starts a batch with a contiguous range of task indices, and a thread that
+// runs out of work steals the back half of another thread's remaining range,
+// so uneven tasks still keep every thread busy.
+class ThreadPool {
+ public:
+  // Starts a pool with the given number of threads, or one per core if
+  // `threads` is zero. The calling thread counts as one of them.
+  explicit ThreadPool(unsigned threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // The number of threads that run tasks, including the calling thread.
+  inline unsigned size() const {
+    return size_;
+  }
+
+  // Calls `task(i)` for every `i` in [0, count), returning once every call
+  // has returned. Calls run concurrently and in no particular order.
+  void run(size_t count, const std::function<void(size_t)>& task);
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  void work(unsigned index);
+  void drain(unsigned index);
+  bool next(unsigned index, size_t& task);
+
+  unsigned size_;
+  std::unique_ptr<Queue[]> queues_;
+  vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable started_;
+  std::condition_variable finished_;
+  const std::function<void(size_t)>* task_ = nullptr;
+  std::atomic<size_t> remaining_{0};
+  size_t generation_ = 0;
+  bool stopping_ = false;
+};
+
+}
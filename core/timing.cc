@@ -0,0 +1,335 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "timing.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <iomanip>
+
+namespace compiler {
+
+// The width of the name column of the table we print
+static const int name_width = 44;
+
+// Returns the CPU time of the whole process in milliseconds.
+static double process_cpu_time() {
+  timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+// Writes the given string as a JSON string literal.
+static void print_json_string(std::ostream& out, const string& value) {
+  out << '"';
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << static_cast<int>(c) << std::dec << std::setfill(' ');
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+Timing::Timing(bool trace)
+    : trace_(trace),
+      threads_{std::this_thread::get_id()},
+      start_(wall_time()),
+      cpu_start_(process_cpu_time()) {
+}
+
+double Timing::wall_time() {
+  return std::chrono::duration<double, std::milli>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+double Timing::thread_cpu_time() {
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+void Timing::add(const string& path, const string& phase,
+                 const string& detail, double wall, double cpu) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto file = std::find_if(files_.begin(), files_.end(),
+                           [&](auto& file) { return file.path == path; });
+  if (file == files_.end()) {
+    files_.push_back(FileTimes{path, {}});
+    file = files_.end() - 1;
+  }
+  auto times = std::find_if(file->phases.begin(), file->phases.end(),
+                            [&](auto& times) { return times.name == phase; });
+  if (times == file->phases.end()) {
+    file->phases.emplace_back();
+    times = file->phases.end() - 1;
+    times->name = phase;
+  }
+  if (detail.empty()) {
+    times->wall += wall;
+    times->cpu += cpu;
+    return;
+  }
+  auto details = std::find_if(
+      times->details.begin(), times->details.end(),
+      [&](auto& details) { return details.name == detail; });
+  if (details == times->details.end()) {
+    times->details.push_back(Times{detail});
+    details = times->details.end() - 1;
+  }
+  details->wall += wall;
+  details->cpu += cpu;
+}
+
+void Timing::add_report(
+    const string& name,
+    std::function<void(std::ostream& out, bool json)> report) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  reports_.emplace_back(name, std::move(report));
+}
+
+vector<Timing::PhaseTimes> Timing::totals() const {
+  vector<PhaseTimes> totals;
+  for (auto& file : files_) {
+    for (auto& phase : file.phases) {
+      auto total = std::find_if(
+          totals.begin(), totals.end(),
+          [&](auto& total) { return total.name == phase.name; });
+      if (total == totals.end()) {
+        totals.emplace_back();
+        total = totals.end() - 1;
+        total->name = phase.name;
+      }
+      total->wall += phase.wall;
+      total->cpu += phase.cpu;
+    }
+  }
+  return totals;
+}
+
+// Prints a row of the table with the given indentation.
+static void print_row(std::ostream& out, int indent, const string& name,
+                      double wall, double cpu) {
+  out << string(indent, ' ') << std::left << std::setw(name_width - indent)
+      << name << std::right << std::setw(12) << wall << std::setw(12) << cpu
+      << std::endl;
+}
+
+void Timing::print(std::ostream& out) {
+  auto wall = wall_time() - start_;
+  auto cpu = process_cpu_time() - cpu_start_;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto flags = out.flags();
+  out << std::fixed << std::setprecision(2) << std::left
+      << std::setw(name_width) << "Time (ms)" << std::right << std::setw(12)
+      << "Wall" << std::setw(12) << "CPU" << std::endl;
+  for (auto& file : files_) {
+    if (file.path.empty()) {
+      continue;
+    }
+    out << file.path << std::endl;
+    for (auto& phase : file.phases) {
+      print_row(out, 2, phase.name, phase.wall, phase.cpu);
+
+      // Like LLVM, we list the most expensive parts first
+      auto details = phase.details;
+      std::stable_sort(details.begin(), details.end(),
+                       [](auto& a, auto& b) { return a.wall > b.wall; });
+      for (auto& detail : details) {
+        print_row(out, 4, detail.name, detail.wall, detail.cpu);
+      }
+    }
+  }
+  out << "Total" << std::endl;
+  for (auto& phase : totals()) {
+    print_row(out, 2, phase.name, phase.wall, phase.cpu);
+  }
+  print_row(out, 2, "command", wall, cpu);
+  out.flags(flags);
+
+  for (auto& report : reports_) {
+    out << std::endl << report.first << std::endl;
+    report.second(out, false);
+  }
+}
+
+void Timing::print_json(std::ostream& out, const Times& times) {
+  out << "{\"name\": ";
+  print_json_string(out, times.name);
+  out << ", \"wall_ms\": " << times.wall << ", \"cpu_ms\": " << times.cpu;
+}
+
+void Timing::print_json(std::ostream& out) {
+  auto wall = wall_time() - start_;
+  auto cpu = process_cpu_time() - cpu_start_;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto flags = out.flags();
+  out << std::fixed << std::setprecision(3);
+
+  auto print_phases = [&](const vector<PhaseTimes>& phases) {
+    out << "[";
+    for (size_t i = 0; i < phases.size(); i++) {
+      out << (i > 0 ? ", " : "");
+      print_json(out, phases[i]);
+      if (!phases[i].details.empty()) {
+        out << ", \"details\": [";
+        for (size_t j = 0; j < phases[i].details.size(); j++) {
+          out << (j > 0 ? ", " : "");
+          print_json(out, phases[i].details[j]);
+          out << "}";
+        }
+        out << "]";
+      }
+      out << "}";
+    }
+    out << "]";
+  };
+
+  out << "{\"files\": [";
+  bool first = true;
+  for (auto& file : files_) {
+    if (file.path.empty()) {
+      continue;
+    }
+    out << (first ? "" : ", ") << "{\"path\": ";
+    print_json_string(out, file.path);
+    out << ", \"phases\": ";
+    print_phases(file.phases);
+    out << "}";
+    first = false;
+  }
+  out << "], \"total\": {\"phases\": ";
+  print_phases(totals());
+  out << ", \"wall_ms\": " << wall << ", \"cpu_ms\": " << cpu << "}";
+  out.flags(flags);
+
+  out << ", \"reports\": {";
+  for (size_t i = 0; i < reports_.size(); i++) {
+    out << (i > 0 ? ", " : "");
+    print_json_string(out, reports_[i].first);
+    out << ": ";
+    reports_[i].second(out, true);
+  }
+  out << "}}" << std::endl;
+}
+
+void Timing::add_span(const string& name, const string& detail, double begin,
+                      double end) {
+  if (!trace_) {
+    return;
+  }
+  auto id = std::this_thread::get_id();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto thread = std::find(threads_.begin(), threads_.end(), id);
+  if (thread == threads_.end()) {
+    threads_.push_back(id);
+    thread = threads_.end() - 1;
+  }
+  events_.push_back(TraceEvent{name, detail,
+                               static_cast<size_t>(thread - threads_.begin()),
+                               begin, end});
+}
+
+void Timing::print_trace(std::ostream& out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Viewers nest spans that start at the same time in the order they are
+  // listed, so we list the outer span first
+  auto events = events_;
+  std::stable_sort(events.begin(), events.end(), [](auto& a, auto& b) {
+    return a.thread != b.thread
+               ? a.thread < b.thread
+               : a.begin != b.begin ? a.begin < b.begin : a.end > b.end;
+  });
+
+  // Times are in microseconds since the command started
+  auto flags = out.flags();
+  out << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+  for (size_t i = 0; i < threads_.size(); i++) {
+    out << (i > 0 ? ",\n" : "\n")
+        << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+        << "\"tid\": " << i << ", \"args\": {\"name\": \""
+        << (i == 0 ? "main" : "worker " + std::to_string(i)) << "\"}}";
+  }
+  for (auto& event : events) {
+    out << ",\n{\"name\": ";
+    print_json_string(out, event.name);
+    out << ", \"cat\": \"compiler\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+        << event.thread << ", \"ts\": " << (event.begin - start_) * 1000
+        << ", \"dur\": " << (event.end - event.begin) * 1000;
+    if (!event.detail.empty()) {
+      out << ", \"args\": {\"detail\": ";
+      print_json_string(out, event.detail);
+      out << "}";
+    }
+    out << "}";
+  }
+  out << "\n], \"displayTimeUnit\": \"ms\"}" << std::endl;
+  out.flags(flags);
+}
+
+Timing::Phase::Phase(Timing* timing, const string& path, const string& phase,
+                     bool trace)
+    : timing_(timing), trace_(trace) {
+  if (timing_) {
+    path_ = path;
+    phase_ = phase;
+    start_ = wall_time();
+    cpu_start_ = thread_cpu_time();
+  }
+}
+
+Timing::Phase::~Phase() {
+  stop();
+}
+
+void Timing::Phase::stop() {
+  if (timing_) {
+    auto end = wall_time();
+    timing_->add(path_, phase_, "", end - start_,
+                 thread_cpu_time() - cpu_start_);
+    if (trace_) {
+      timing_->add_span(phase_, path_, start_, end);
+    }
+    timing_ = nullptr;
+  }
+}
+
+Timing::Span::Span(Timing* timing, const string& name, const string& detail)
+    : timing_(timing && timing->tracing() ? timing : nullptr) {
+  if (timing_) {
+    name_ = name;
+    detail_ = detail;
+    start_ = wall_time();
+  }
+}
+
+Timing::Span::~Span() {
+  stop();
+}
+
+void Timing::Span::stop() {
+  if (timing_) {
+    timing_->add_span(name_, detail_, start_, wall_time());
+    timing_ = nullptr;
+  }
+}
+
+}
@@ -0,0 +1,175 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+
+namespace compiler {
+
+// Records the wall and CPU time of each phase of a command, e.g., parsing or
+// code generation, for each file and in total. Phases may be timed on any
+// thread, and the times of a phase timed more than once add up. The CPU time
+// of a phase is that of the thread that ran it, so a phase that runs on
+// several threads counts only its own thread's share. If tracing is enabled,
+// we also record a span for each phase and for finer steps, e.g., each LLVM
+// pass, on the thread that ran it, for a timeline of the command.
+class Timing {
+ public:
+  class Phase;
+  class Span;
+
+  // Starts the total time of the command. The calling thread is the main
+  // thread of the trace.
+  explicit Timing(bool trace = false);
+
+  // Whether we record spans for a trace.
+  inline bool tracing() const {
+    return trace_;
+  }
+
+  // Adds the given times, in milliseconds, to a phase of the file at `path`,
+  // or of no file if `path` is empty. If `detail` is not empty, e.g., the
+  // name of an LLVM pass, the times are added to that part of the phase
+  // instead, which is included in the times of the phase itself.
+  void add(const string& path, const string& phase, const string& detail,
+           double wall, double cpu);
+
+  // Adds a report from another source, e.g., LLVM's own pass timers, which
+  // we print after our times under the given name. `report` writes a JSON
+  // value if `json` is true, and text otherwise.
+  void add_report(const string& name,
+                  std::function<void(std::ostream& out, bool json)> report);
+
+  // Prints a table of the times recorded so far.
+  void print(std::ostream& out);
+
+  // Prints the times recorded so far as a JSON object.
+  void print_json(std::ostream& out);
+
+  // Adds a span of the trace on the calling thread, from `begin` to `end` as
+  // returned by wall_time(). `detail`, e.g., the path of a file, is shown
+  // with the span if it is not empty. Does nothing unless we are tracing.
+  void add_span(const string& name, const string& detail, double begin,
+                double end);
+
+  // Prints the spans recorded so far in the Trace Event Format, which
+  // chrome://tracing and Perfetto display as a timeline with a track for each
+  // thread.
+  void print_trace(std::ostream& out);
+
+  // Returns the milliseconds since an arbitrary point in the past, for
+  // measuring wall times.
+  static double wall_time();
+
+  // Returns the CPU time of the calling thread in milliseconds.
+  static double thread_cpu_time();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Times {
+    string name;
+    double wall = 0;
+    double cpu = 0;
+  };
+
+  struct PhaseTimes : public Times {
+    vector<Times> details;
+  };
+
+  struct FileTimes {
+    string path;
+    vector<PhaseTimes> phases;
+  };
+
+  struct TraceEvent {
+    string name;
+    string detail;
+    size_t thread;
+    double begin;
+    double end;
+  };
+
+  // Returns the phases of no file and the totals of each phase of all files.
+  vector<PhaseTimes> totals() const;
+
+  static void print_json(std::ostream& out, const Times& times);
+
+  std::mutex mutex_;
+  bool trace_;
+  vector<FileTimes> files_;
+  vector<TraceEvent> events_;
+
+  // The threads that recorded spans, numbered in the order they first did
+  vector<std::thread::id> threads_;
+
+  vector<std::pair<string, std::function<void(std::ostream&, bool)>>>
+      reports_;
+  double start_;
+  double cpu_start_;
+};
+
+// Times a phase from its construction until it is stopped or destroyed. If
+// the timing is null, it does nothing, so phases can be timed
+// unconditionally. The phase is also a span of the trace unless `trace` is
+// false, e.g., for phases timed separately for every expression, which would
+// flood the trace.
+class Timing::Phase {
+ public:
+  Phase(Timing* timing, const string& path, const string& phase,
+        bool trace = true);
+  Phase(const Phase&) = delete;
+  Phase& operator=(const Phase&) = delete;
+  ~Phase();
+
+  // Adds the time since the phase started to the timing.
+  void stop();
+
+ private:
+  Timing* timing_;
+  string path_;
+  string phase_;
+  bool trace_;
+  double start_;
+  double cpu_start_;
+};
+
+// Records a span of the trace from its construction until it is stopped or
+// destroyed, e.g., for a step of a phase. If the timing is null or is not
+// tracing, it does nothing.
+class Timing::Span {
+ public:
+  Span(Timing* timing, const string& name, const string& detail = "");
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+  ~Span();
+
+  // Adds the span up to now to the trace.
+  void stop();
+
+ private:
+  Timing* timing_;
+  string name_;
+  string detail_;
+  double start_;
+};
+
+}
@@ -16,33 +16,171 @@
 
 #include <llvm/IR/Verifier.h>
 
-#include "expression.h"
+#include "../runtime/output.h"
 
 namespace compiler::emitter {
 
-llvm::Function* emit(shared_ptr<parser::Module> ast,
-                     llvm::Module* llvm_module) {
-  llvm::IRBuilder<> builder(llvm_module->getContext());
-
-  auto printf = llvm::Function::Create(
-      llvm::FunctionType::get(builder.getInt32Ty(),
-                              {llvm::PointerType::get(builder.getInt8Ty(), 0)},
-                              true),
-      llvm::Function::ExternalLinkage, "printf", llvm_module);
-
-  auto main = llvm::Function::Create(
-      llvm::FunctionType::get(builder.getInt32Ty(), {}, false),
-      llvm::Function::ExternalLinkage, "main", llvm_module);
-  auto block = llvm::BasicBlock::Create(builder.getContext(), "", main);
-  builder.SetInsertPoint(block);
-
-  // Print the result of every expression to stdout with printf
-  auto printf_format = builder.CreateGlobalStringPtr("%d\n");
-  for (auto expression : ast->expressions) {
-    auto value = emit_expression(builder, expression);
-    builder.CreateCall(printf, {printf_format, value});
+// Returns the type of main and of the functions it calls.
+static llvm::FunctionType* main_type(llvm::LLVMContext& context) {
+  return llvm::FunctionType::get(llvm::Type::getInt32Ty(context), {}, false);
+}
+
+llvm::Function* emit(shared_ptr<parser::Module> ast, llvm::Module* llvm_module,
+                     size_t function_size, Timing* timing) {
+  auto& expressions = ast->expressions;
+  if (function_size == 0 || expressions.size() <= function_size) {
+    Timing::Span span(timing, "emit function", "main");
+    FunctionEmitter emitter(llvm_module, "main");
+    for (auto expression : expressions) {
+      emitter.add(ast->nodes, expression);
+    }
+    return emitter.finish();
+  }
+
+  auto functions =
+      emit_functions(ast, llvm_module, 0, expressions.size(), function_size,
+                     "chunk.", llvm::Function::InternalLinkage, timing);
+  Timing::Span span(timing, "emit function", "main");
+  return emit_main(llvm_module, functions);
+}
+
+vector<string> emit_functions(shared_ptr<parser::Module> ast,
+                              llvm::Module* llvm_module, size_t begin,
+                              size_t end, size_t function_size,
+                              const string& prefix,
+                              llvm::Function::LinkageTypes linkage,
+                              Timing* timing) {
+  // The inliner would merge functions with a single caller back into main,
+  // so we forbid it
+  vector<string> functions;
+  for (auto first = begin; first < end; first += function_size) {
+    functions.push_back(prefix + std::to_string(functions.size()));
+    Timing::Span span(timing, "emit function", functions.back());
+    FunctionEmitter emitter(llvm_module, functions.back(), linkage);
+    auto last = std::min(first + function_size, end);
+    for (auto i = first; i < last; i++) {
+      emitter.add(ast->nodes, ast->expressions[i]);
+    }
+    emitter.finish()->addFnAttr(llvm::Attribute::NoInline);
+  }
+  return functions;
+}
+
+FunctionEmitter::FunctionEmitter(llvm::Module* llvm_module, const string& name,
+                                 llvm::Function::LinkageTypes linkage)
+    : builder_(llvm_module->getContext()),
+      expressions_(builder_),
+      print_(declare_print(llvm_module)),
+      size_(0) {
+  function_ = llvm::Function::Create(main_type(builder_.getContext()),
+                                     linkage, name, llvm_module);
+  auto block = llvm::BasicBlock::Create(builder_.getContext(), "", function_);
+  builder_.SetInsertPoint(block);
+}
+
+void FunctionEmitter::add(const parser::NodeTable& nodes,
+                          parser::NodeTable::Index expression) {
+  // Print the result of the expression to stdout
+  auto value = expressions_.emit(nodes, expression);
+  builder_.CreateCall(print_, {value});
+  size_++;
+}
+
+llvm::Function* FunctionEmitter::finish() {
+  builder_.CreateRet(builder_.getInt32(0));
+  builder_.ClearInsertionPoint();
+  llvm::verifyFunction(*function_);
+  return function_;
+}
+
+BatchEmitter::BatchEmitter(const Start& start, const Finish& finish,
+                           const string& name, Timing* timing)
+    : start_(start),
+      finish_(finish),
+      name_(name),
+      timing_(timing),
+      module_(nullptr) {
+}
+
+bool BatchEmitter::add(const parser::NodeTable& nodes,
+                       parser::NodeTable::Index expression, bool complete) {
+  Timing::Phase emit_phase(timing_, name_, "emit", false);
+  if (!function_emitter_) {
+    context_ = std::make_unique<llvm::LLVMContext>();
+    functions_.push_back("batch." + std::to_string(functions_.size()));
+    module_ = start_(*context_, functions_.back());
+    if (!module_) {
+      functions_.pop_back();
+      context_.reset();
+      return false;
+    }
+    function_emitter_ =
+        std::make_unique<FunctionEmitter>(module_, functions_.back());
   }
 
+  // A streaming parse clears its NodeTable after each expression
+  function_emitter_->add(nodes, expression);
+  function_emitter_->clear_nodes();
+  emit_phase.stop();
+  if (function_emitter_->size() >= batch_size || complete) {
+    finish();
+  }
+  return true;
+}
+
+void BatchEmitter::finish() {
+  if (!function_emitter_) {
+    return;
+  }
+  Timing::Phase emit_phase(timing_, name_, "emit");
+  auto function = function_emitter_->finish();
+  function_emitter_.reset();
+  emit_phase.stop();
+  finish_(module_, function);
+  module_ = nullptr;
+  context_.reset();
+}
+
+llvm::Function* emit_main(llvm::Module* llvm_module,
+                          const vector<string>& functions) {
+  auto& context = llvm_module->getContext();
+  llvm::IRBuilder<> builder(context);
+  auto main = llvm::Function::Create(main_type(context),
+                                     llvm::Function::ExternalLinkage, "main",
+                                     llvm_module);
+  builder.SetInsertPoint(llvm::BasicBlock::Create(context, "", main));
+  for (auto& name : functions) {
+    builder.CreateCall(
+        llvm_module->getOrInsertFunction(name, main_type(context)));
+  }
+  builder.CreateRet(builder.getInt32(0));
+  builder.ClearInsertionPoint();
+  llvm::verifyFunction(*main);
+  return main;
+}
+
+llvm::Function* emit_image(llvm::Module* llvm_module,
+                           const vector<int64_t>& values) {
+  string output;
+  char line[runtime::max_line];
+  for (auto value : values) {
+    output.append(line, runtime::format(value, line));
+  }
+
+  auto& context = llvm_module->getContext();
+  llvm::IRBuilder<> builder(context);
+  auto data = llvm::ConstantDataArray::getString(context, output, false);
+  auto image = llvm::cast<llvm::GlobalVariable>(
+      llvm_module->getOrInsertGlobal("image", data->getType()));
+  image->setLinkage(llvm::GlobalValue::PrivateLinkage);
+  image->setInitializer(data);
+  image->setConstant(true);
+
+  auto main = llvm::Function::Create(main_type(context),
+                                     llvm::Function::ExternalLinkage, "main",
+                                     llvm_module);
+  builder.SetInsertPoint(llvm::BasicBlock::Create(context, "", main));
+  emit_write(builder, llvm_module, image, builder.getInt64(output.size()));
   builder.CreateRet(builder.getInt32(0));
   builder.ClearInsertionPoint();
   llvm::verifyFunction(*main);
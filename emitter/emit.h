@@ -15,14 +15,139 @@
 #pragma once
 
 #include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 
+#include "../core/timing.h"
 #include "../parser/ast.h"
+#include "expression.h"
+#include "runtime.h"
 
 namespace compiler::emitter {
 
 // Emits the LLVM IR code for the given module into the given LLVM module. We
 // return the generated main function, which can be executed to run the program.
-llvm::Function* emit(shared_ptr<parser::Module> ast, llvm::Module* llvm_module);
+// If `function_size` is nonzero and the program has more top-level
+// expressions than that, we emit them in internal functions of at most
+// `function_size` expressions each, which main calls in order, since the
+// optimizer takes superlinear time on a single huge function. The program
+// prints with the runtime, which callers define with emit_runtime() unless
+// they provide their own. If `timing` is not null and tracing, we add a span
+// for each function we emit.
+llvm::Function* emit(shared_ptr<parser::Module> ast, llvm::Module* llvm_module,
+                     size_t function_size = 0, Timing* timing = nullptr);
+
+// Emits the top-level expressions in [begin, end) into noinline functions
+// with the signature of main, each with at most `function_size` expressions,
+// and named `prefix` followed by a number. We return the names of the
+// functions in order, e.g., for emit_main. If `timing` is not null and
+// tracing, we add a span for each function.
+vector<string> emit_functions(shared_ptr<parser::Module> ast,
+                              llvm::Module* llvm_module, size_t begin,
+                              size_t end, size_t function_size,
+                              const string& prefix,
+                              llvm::Function::LinkageTypes linkage,
+                              Timing* timing = nullptr);
+
+// Emits a function that prints the value of each top-level expression added
+// to it with the print function of the runtime. This lets us emit programs in
+// pieces, e.g., as they are parsed, rather than all at once from a complete
+// Module.
+class FunctionEmitter {
+ public:
+  // Starts a new function with the given name and the signature of main.
+  FunctionEmitter(llvm::Module* llvm_module, const string& name,
+                  llvm::Function::LinkageTypes linkage =
+                      llvm::Function::ExternalLinkage);
+
+  // Emits code to print the value of the given expression. Nodes shared
+  // with expressions added earlier are not emitted again.
+  void add(const parser::NodeTable& nodes, parser::NodeTable::Index expression);
+
+  // Forgets the nodes emitted so far. Call this if the NodeTable passed to
+  // add() is cleared.
+  inline void clear_nodes() {
+    expressions_.clear();
+  }
+
+  // The number of expressions added so far.
+  inline size_t size() const {
+    return size_;
+  }
+
+  // Completes and returns the function.
+  llvm::Function* finish();
+
+ private:
+  llvm::IRBuilder<> builder_;
+  ExpressionEmitter expressions_;
+  llvm::Function* function_;
+  llvm::FunctionCallee print_;
+  size_t size_;
+};
+
+// Emits a program as it is parsed into a series of LLVM modules, each with
+// a fresh context and a single function that prints a batch of expressions,
+// so memory use does not grow with the size of the input. The caller
+// creates each module and compiles, runs or prints it once its batch is
+// complete.
+class BatchEmitter {
+ public:
+  // The maximum number of expressions in each batch.
+  static const size_t batch_size = 16 * 1024;
+
+  // Returns a new module in the given context for the batch function with
+  // the given name, or null on error.
+  using Start = std::function<llvm::Module*(llvm::LLVMContext& context,
+                                            const string& function)>;
+
+  // Receives the module and function of each complete batch. The module
+  // must be destroyed by the time this returns, since its context is next.
+  using Finish =
+      std::function<void(llvm::Module* llvm_module, llvm::Function* function)>;
+
+  // We add the phases of each batch to `timing` under `name`, if it is not
+  // null.
+  BatchEmitter(const Start& start, const Finish& finish, const string& name,
+               Timing* timing = nullptr);
+
+  // Emits code to print the given expression from a streaming parse,
+  // completing the batch if it is full or if `complete` is true. Returns
+  // false if we could not start a batch.
+  bool add(const parser::NodeTable& nodes, parser::NodeTable::Index expression,
+           bool complete = false);
+
+  // Completes the current batch, if any.
+  void finish();
+
+  // The names of the batch functions so far, in order, e.g., for emit_main.
+  inline const vector<string>& functions() const {
+    return functions_;
+  }
+
+ private:
+  Start start_;
+  Finish finish_;
+  string name_;
+  Timing* timing_;
+  std::unique_ptr<llvm::LLVMContext> context_;
+  llvm::Module* module_;
+  std::unique_ptr<FunctionEmitter> function_emitter_;
+  vector<string> functions_;
+};
+
+// Emits a main function that calls the functions with the given names, which
+// have the signature of main, in order.
+llvm::Function* emit_main(llvm::Module* llvm_module,
+                          const vector<string>& functions);
+
+// Emits a main function that prints the given values, e.g., the values of
+// the top-level expressions computed by the checker, with the output
+// rendered at compile time into a constant array and written with a single
+// call to write(2) in the common case. The program does not need the
+// runtime.
+llvm::Function* emit_image(llvm::Module* llvm_module,
+                           const vector<int64_t>& values);
 
 }
@@ -9,70 +9,90 @@ namespace compiler::emitter {
 
 namespace {
 
-class Emitter : private parser::Expression::Handler {
- public:
-  Emitter(llvm::IRBuilder<>& builder) : builder_(builder), result_(nullptr) {
+llvm::Value* emit_binary(llvm::IRBuilder<>& builder,
+                         parser::NodeTable::Opcode op, llvm::Value* lhs,
+                         llvm::Value* rhs) {
+  switch (op) {
+    case parser::NodeTable::ADD:
+      return builder.CreateAdd(lhs, rhs);
+    case parser::NodeTable::SUBTRACT:
+      return builder.CreateSub(lhs, rhs);
+    case parser::NodeTable::DIVIDE:
+      return builder.CreateSDiv(lhs, rhs);
+    case parser::NodeTable::MULTIPLY:
+      return builder.CreateMul(lhs, rhs);
+    case parser::NodeTable::MOD:
+      return builder.CreateSRem(lhs, rhs);
+    case parser::NodeTable::SHIFT_LEFT:
+      return builder.CreateShl(lhs, rhs);
+    case parser::NodeTable::SHIFT_RIGHT:
+      return builder.CreateLShr(lhs, rhs);
+    case parser::NodeTable::BIT_AND:
+      return builder.CreateAnd(lhs, rhs);
+    case parser::NodeTable::BIT_OR:
+      return builder.CreateOr(lhs, rhs);
+    case parser::NodeTable::BIT_XOR:
+      return builder.CreateXor(lhs, rhs);
+    case parser::NodeTable::INTEGER_LITERAL:
+      break;
   }
+  assert(false);
+  return nullptr;
+}
 
-  llvm::Value* emit(shared_ptr<parser::Expression> expression) {
-    expression->handle(*this);
-    assert(result_);
-    return result_;
-  }
+}
 
- private:
-  void handle_binary(parser::Binary& ast) override {
-    auto lhs = emit_expression(builder_, ast.lhs);
-    auto rhs = emit_expression(builder_, ast.rhs);
-    switch (ast.op) {
-      case parser::Binary::ADD:
-        result_ = builder_.CreateAdd(lhs, rhs);
-        break;
-      case parser::Binary::SUBTRACT:
-        result_ = builder_.CreateSub(lhs, rhs);
-        break;
-      case parser::Binary::DIVIDE:
-        result_ = builder_.CreateSDiv(lhs, rhs);
-        break;
-      case parser::Binary::MULTIPLY:
-        result_ = builder_.CreateMul(lhs, rhs);
-        break;
-      case parser::Binary::MOD:
-        result_ = builder_.CreateSRem(lhs, rhs);
-        break;
-      case parser::Binary::SHIFT_LEFT:
-        result_ = builder_.CreateShl(lhs, rhs);
-        break;
-      case parser::Binary::SHIFT_RIGHT:
-        result_ = builder_.CreateLShr(lhs, rhs);
-        break;
-      case parser::Binary::BIT_AND:
-        result_ = builder_.CreateAnd(lhs, rhs);
-        break;
-      case parser::Binary::BIT_OR:
-        result_ = builder_.CreateOr(lhs, rhs);
-        break;
-      case parser::Binary::BIT_XOR:
-        result_ = builder_.CreateXor(lhs, rhs);
-        break;
-    }
+llvm::Value* ExpressionEmitter::emit(const parser::NodeTable& nodes,
+                                     parser::NodeTable::Index root) {
+  if (!nodes.is_sharing()) {
+    // The subtree is stored in post-order, so every operand is emitted
+    // before the node that uses it in a single forward scan.
+    auto first = nodes.first(root);
+    values_.resize(root - first + 1);
+    nodes.visit_postorder(root, [&](parser::NodeTable::Index node) {
+      if (nodes.is_binary(node)) {
+        values_[node - first] =
+            emit_binary(builder_, nodes.opcodes[node],
+                        values_[nodes.lhs[node] - first],
+                        values_[nodes.rhs[node] - first]);
+      } else {
+        values_[node - first] = builder_.getInt64(nodes.value(node));
+      }
+    });
+    return values_.back();
   }
 
-  void handle_integer_literal(parser::IntegerLiteral& ast) override {
-    result_ = builder_.getInt64(ast.value);
+  // Shared subtrees are not contiguous, so we walk the DAG depth first,
+  // skipping nodes we have already emitted.
+  if (values_.size() < nodes.size()) {
+    values_.resize(nodes.size());
   }
-
-  llvm::IRBuilder<>& builder_;
-  llvm::Value* result_;
-};
-
+  stack_.push_back(root);
+  while (!stack_.empty()) {
+    auto node = stack_.back();
+    if (values_[node]) {
+      stack_.pop_back();
+    } else if (!nodes.is_binary(node)) {
+      values_[node] = builder_.getInt64(nodes.value(node));
+      stack_.pop_back();
+    } else {
+      auto lhs = nodes.lhs[node];
+      auto rhs = nodes.rhs[node];
+      if (values_[lhs] && values_[rhs]) {
+        values_[node] = emit_binary(builder_, nodes.opcodes[node],
+                                    values_[lhs], values_[rhs]);
+        stack_.pop_back();
+      } else {
+        stack_.push_back(rhs);
+        stack_.push_back(lhs);
+      }
+    }
+  }
+  return values_[root];
 }
 
-// Emits the given expression to the given LLVM builder, returning the LLVM
-// value that stores the result of the expression.
-llvm::Value* emit_expression(llvm::IRBuilder<>& builder,
-                             shared_ptr<parser::Expression> expression) {
-  return Emitter(builder).emit(expression);
+void ExpressionEmitter::clear() {
+  values_.clear();
 }
 
 }
@@ -10,9 +10,31 @@
 
 namespace compiler::emitter {
 
-// Emits the given expression to the given LLVM builder, returning the LLVM
-// value that stores the result of the expression.
-llvm::Value* emit_expression(llvm::IRBuilder<>& builder,
-                             shared_ptr<parser::Expression> expression);
+// Emits expressions from a NodeTable to an LLVM builder. If the table shares
+// nodes, we emit each shared node once and reuse its value in every
+// expression that uses it, so the IR is only as large as the DAG. All of the
+// expressions must be emitted in the same function.
+class ExpressionEmitter {
+ public:
+  ExpressionEmitter(llvm::IRBuilder<>& builder) : builder_(builder) {
+  }
+
+  // Emits the given expression, returning the LLVM value that stores its
+  // result.
+  llvm::Value* emit(const parser::NodeTable& nodes,
+                    parser::NodeTable::Index root);
+
+  // Forgets the values of the nodes emitted so far. Call this if the table
+  // is cleared.
+  void clear();
+
+ private:
+  llvm::IRBuilder<>& builder_;
+
+  // The value of each node of the current expression, or of every node in
+  // the table if it shares nodes
+  vector<llvm::Value*> values_;
+  vector<parser::NodeTable::Index> stack_;
+};
 
 }
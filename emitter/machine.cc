@@ -0,0 +1,97 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "machine.h"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetRegistry.h>
+
+#include <algorithm>
+
+namespace compiler::emitter {
+
+// Returns the features of the host processor in the format of -mattr,
+// sorted so the description of a machine is stable.
+static string host_features() {
+  llvm::StringMap<bool> host;
+  if (!llvm::sys::getHostCPUFeatures(host)) {
+    return "";
+  }
+  vector<string> names;
+  for (auto& feature : host) {
+    names.push_back((feature.second ? "+" : "-") + feature.first().str());
+  }
+  std::sort(names.begin(), names.end());
+  llvm::SubtargetFeatures features;
+  for (auto& name : names) {
+    features.AddFeature(name);
+  }
+  return features.getString();
+}
+
+bool resolve_machine(shared_ptr<Error> error, const llvm::Target* llvm_target,
+                     const string& triple, MachineOptions& options) {
+  if (options.cpu == "native") {
+    options.cpu = llvm::sys::getHostCPUName().str();
+    auto features = host_features();
+    if (!options.features.empty()) {
+      features += (features.empty() ? "" : ",") + options.features;
+    }
+    options.features = features;
+  }
+
+  // LLVM only warns about processors it does not know, and then generates
+  // code for the generic one
+  std::unique_ptr<llvm::MCSubtargetInfo> info(
+      llvm_target->createMCSubtargetInfo(triple, "", ""));
+  if (!info || !info->isCPUStringValid(options.cpu)) {
+    error->report(Error::ERROR, "Unknown processor " + options.cpu +
+                                    " for target " + triple);
+    return false;
+  }
+  return true;
+}
+
+llvm::TargetMachine* create_target_machine(const llvm::Target* llvm_target,
+                                           const string& triple,
+                                           const MachineOptions& options) {
+  return llvm_target->createTargetMachine(triple, options.cpu,
+                                          options.features,
+                                          llvm::TargetOptions(), options.reloc,
+                                          options.code_model);
+}
+
+string describe_machine(const llvm::TargetMachine* llvm_machine) {
+  // In the order of LLVM's enums
+  static const char* const reloc_names[] = {"static", "pic", "dynamic-no-pic",
+                                            "ropi",   "rwpi", "ropi-rwpi"};
+  static const char* const code_model_names[] = {"tiny", "small", "kernel",
+                                                 "medium", "large"};
+  string description = "Target " + llvm_machine->getTargetTriple().str() +
+                       ", processor " + llvm_machine->getTargetCPU().str();
+  auto features = llvm_machine->getTargetFeatureString();
+  if (!features.empty()) {
+    description += ", features " + features.str();
+  }
+  description += ", relocation model ";
+  description += reloc_names[llvm_machine->getRelocationModel()];
+  description += ", code model ";
+  description += code_model_names[llvm_machine->getCodeModel()];
+  return description;
+}
+
+}
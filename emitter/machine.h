@@ -0,0 +1,57 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <llvm/ADT/Optional.h>
+#include <llvm/Support/CodeGen.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "../core/common.h"
+#include "../core/error.h"
+
+namespace compiler::emitter {
+
+// How we generate machine code, as in clang's -mcpu, -mattr, -fPIC and
+// -mcmodel options
+struct MachineOptions {
+  // The processor whose instructions and scheduling model we use, or
+  // "native" for the processor we run on
+  string cpu = "generic";
+
+  // Features to enable or disable in addition to those of the processor,
+  // e.g., "+avx2,-bmi2"
+  string features;
+
+  // The target's defaults if unset
+  llvm::Optional<llvm::Reloc::Model> reloc;
+  llvm::Optional<llvm::CodeModel::Model> code_model;
+};
+
+// Replaces "native" in the given options with the name and features of the
+// host processor, and checks that the target knows the processor. Reports
+// an error and returns false if it does not.
+bool resolve_machine(shared_ptr<Error> error, const llvm::Target* llvm_target,
+                     const string& triple, MachineOptions& options);
+
+// Creates a machine that generates code for the given target triple.
+llvm::TargetMachine* create_target_machine(const llvm::Target* llvm_target,
+                                           const string& triple,
+                                           const MachineOptions& options);
+
+// Returns a one-line description of the target, processor, features and
+// models the given machine generates code for, e.g., for verbose output.
+string describe_machine(const llvm::TargetMachine* llvm_machine);
+
+}
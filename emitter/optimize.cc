@@ -12,30 +12,198 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <llvm/IR/LegacyPassManager.h>
-#include <llvm/IR/Module.h>
-#include <llvm/Transforms/IPO.h>
-#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include "optimize.h"
+
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Support/Timer.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
 
 namespace compiler::emitter {
 
-void optimize(llvm::Module* module) {
-  llvm::PassManagerBuilder builder;
-  builder.OptLevel = 3;
-  builder.Inliner = llvm::createFunctionInliningPass();
+// Passes that only run other passes, whose time we attribute to the passes
+// they run
+static const vector<llvm::StringRef> container_passes = {
+    "PassManager", "PassAdaptor", "AnalysisManagerProxy",
+    "DevirtSCCRepeatedPass", "ModuleInlinerWrapperPass"};
+
+// Returns true if the given pass is one of container_passes. We ignore
+// template arguments, e.g., in PassManager<llvm::Function>, and match the
+// end of the name, e.g., of ModuleToFunctionPassAdaptor.
+static bool is_container_pass(llvm::StringRef pass) {
+  auto name = pass.substr(0, pass.find('<'));
+  for (auto container : container_passes) {
+    if (name.endswith(container)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the name of the function or module a pass runs on, or an empty
+// string for other units of IR, e.g., loops.
+static string ir_name(llvm::Any ir) {
+  if (llvm::any_isa<const llvm::Function*>(ir)) {
+    return llvm::any_cast<const llvm::Function*>(ir)->getName().str();
+  } else if (llvm::any_isa<const llvm::Module*>(ir)) {
+    return llvm::any_cast<const llvm::Module*>(ir)->getModuleIdentifier();
+  }
+  return "";
+}
 
-  llvm::legacy::FunctionPassManager fpm(module);
-  builder.populateFunctionPassManager(fpm);
-  for (auto i = module->begin(); i != module->end(); ++i) {
-    if (!i->isDeclaration()) {
-      fpm.run(*i);
+void time_code_generation(Timing* timing) {
+  llvm::TimePassesIsEnabled = true;
+  timing->add_report("LLVM code generation", [](std::ostream& out,
+                                                bool json) {
+    llvm::raw_os_ostream llvm_out(out);
+    if (json) {
+      llvm_out << "{";
+      llvm::TimerGroup::printAllJSONValues(llvm_out, "");
+      llvm_out << "}";
+    } else {
+      llvm::TimerGroup::printAll(llvm_out);
     }
+
+    // Otherwise LLVM prints the timers again when it shuts down
+    llvm::TimerGroup::clearAll();
+  });
+}
+
+Optimizer::Optimizer(const OptimizeOptions& options)
+    : options_(options),
+      builder_(nullptr, llvm::PipelineTuningOptions(), llvm::None,
+               &instrumentation_) {
+  if (options_.timing) {
+    time_passes();
+  }
+  builder_.registerModuleAnalyses(module_analyses_);
+  builder_.registerCGSCCAnalyses(cgscc_analyses_);
+  builder_.registerFunctionAnalyses(function_analyses_);
+  builder_.registerLoopAnalyses(loop_analyses_);
+  builder_.crossRegisterProxies(loop_analyses_, function_analyses_,
+                                cgscc_analyses_, module_analyses_);
+}
+
+std::unique_ptr<Optimizer> Optimizer::create(shared_ptr<Error> error,
+                                             const OptimizeOptions& options) {
+  std::unique_ptr<Optimizer> optimizer(new Optimizer(options));
+  llvm::ModulePassManager passes;
+  auto build_error = optimizer->build(passes);
+  if (build_error) {
+    error->report(Error::ERROR, "Invalid pass pipeline: " +
+                                    llvm::toString(std::move(build_error)));
+    return nullptr;
   }
-  fpm.doFinalization();
+  return optimizer;
+}
+
+llvm::Error Optimizer::build(llvm::ModulePassManager& passes) {
+  if (!options_.passes.empty()) {
+    return builder_.parsePassPipeline(passes, options_.passes);
+  }
+  // The default pipeline of LLVM 11 does nothing at O0 but inline functions
+  // that must be inlined
+  using Level = llvm::PassBuilder::OptimizationLevel;
+  switch (options_.level) {
+    case OptimizationLevel::O0:
+      passes.addPass(llvm::AlwaysInlinerPass());
+      break;
+    case OptimizationLevel::O1:
+      passes = builder_.buildPerModuleDefaultPipeline(Level::O1);
+      break;
+    case OptimizationLevel::O2:
+      passes = builder_.buildPerModuleDefaultPipeline(Level::O2);
+      break;
+    case OptimizationLevel::O3:
+      passes = builder_.buildPerModuleDefaultPipeline(Level::O3);
+      break;
+    case OptimizationLevel::Os:
+      passes = builder_.buildPerModuleDefaultPipeline(Level::Os);
+      break;
+    case OptimizationLevel::Oz:
+      passes = builder_.buildPerModuleDefaultPipeline(Level::Oz);
+      break;
+  }
+  return llvm::Error::success();
+}
+
+void Optimizer::time_passes() {
+  // Time spent in a pass before and after the passes nested in it counts as
+  // its own, so we stop the timer of the enclosing pass while a nested pass
+  // runs
+  auto pause = [this]() {
+    if (!pass_timers_.empty()) {
+      auto& timer = pass_timers_.back();
+      auto& times = pass_times_[timer.name];
+      times.first += Timing::wall_time() - timer.wall;
+      times.second += Timing::thread_cpu_time() - timer.cpu;
+    }
+  };
+  auto resume = [this]() {
+    if (!pass_timers_.empty()) {
+      pass_timers_.back().wall = Timing::wall_time();
+      pass_timers_.back().cpu = Timing::thread_cpu_time();
+    }
+  };
+  auto after = [this, pause, resume](llvm::StringRef pass) {
+    if (is_container_pass(pass)) {
+      return;
+    }
+    pause();
+    auto& timer = pass_timers_.back();
+    options_.timing->add_span(timer.name, timer.detail, timer.begin,
+                              Timing::wall_time());
+    pass_timers_.pop_back();
+    resume();
+  };
+  // We never skip passes, so every pass we time before it runs also calls
+  // one of the callbacks after it runs
+  instrumentation_.registerBeforePassCallback(
+      [this, pause](llvm::StringRef pass, llvm::Any ir) {
+        if (is_container_pass(pass)) {
+          return true;
+        }
+        pause();
+        string detail;
+        if (options_.timing->tracing()) {
+          detail = ir_name(ir);
+        }
+        auto now = Timing::wall_time();
+        pass_timers_.push_back(PassTimer{pass.str(), std::move(detail), now,
+                                         now, Timing::thread_cpu_time()});
+        return true;
+      });
+  instrumentation_.registerAfterPassCallback(
+      [after](llvm::StringRef pass, llvm::Any) { after(pass); });
+  instrumentation_.registerAfterPassInvalidatedCallback(
+      [after](llvm::StringRef pass) { after(pass); });
+}
+
+void Optimizer::optimize(llvm::Module* module) {
+  auto path = module->getModuleIdentifier();
+  Timing::Phase phase(options_.timing, path, "optimize");
 
-  llvm::legacy::PassManager mpm;
-  builder.populateModulePassManager(mpm);
-  mpm.run(*module);
+  // The standard pipelines cannot run twice, since the inliner's module
+  // wrapper moves its passes into a nested pass manager when it runs, so we
+  // build a fresh pass manager for each module. That takes microseconds,
+  // unlike registering the analyses.
+  llvm::ModulePassManager passes;
+  llvm::cantFail(build(passes));
+  passes.run(*module, module_analyses_);
+
+  // Cached analyses refer to the module, so we forget them before the next
+  // module, which may even be in another LLVM context
+  loop_analyses_.clear();
+  function_analyses_.clear();
+  cgscc_analyses_.clear();
+  module_analyses_.clear();
+
+  // Add up the times of the passes on this thread before we report them, so
+  // the timing is only locked once per module
+  for (auto& [pass, times] : pass_times_) {
+    options_.timing->add(path, "optimize", pass, times.first, times.second);
+  }
+  pass_times_.clear();
 }
 
 }
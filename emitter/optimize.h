@@ -15,10 +15,94 @@
 #pragma once
 
 #include <llvm/IR/Module.h>
+#include <llvm/Passes/PassBuilder.h>
+
+#include "../core/common.h"
+#include "../core/error.h"
+#include "../core/timing.h"
 
 namespace compiler::emitter {
 
-// Runs standard optimization passes on the given LLVM module.
-void optimize(llvm::Module* module);
+// The optimization levels of the standard pipelines, as in clang's -O
+enum class OptimizationLevel {
+  O0,
+  O1,
+  O2,
+  O3,
+  Os,
+  Oz,
+};
+
+// How we optimize the LLVM modules we emit
+struct OptimizeOptions {
+  OptimizationLevel level = OptimizationLevel::O3;
+
+  // A custom pipeline in the format of opt's -passes option, which replaces
+  // the standard pipeline for `level` if it is not empty
+  string passes;
+
+  // If not null, we add the time of each module we optimize to its
+  // "optimize" phase, broken down by pass
+  Timing* timing = nullptr;
+};
+
+// Enables LLVM's timers for the passes of the legacy pass manager, which
+// generates machine code, and adds their report to `timing`. Their times are
+// global, so we report them in total rather than per file.
+void time_code_generation(Timing* timing);
+
+// Runs optimization passes on LLVM modules with the new pass manager. The
+// pass builder and its analysis managers are set up once and reused for
+// every module we optimize, so commands that emit a program as several
+// modules should create a single optimizer. An optimizer must only be used
+// on one thread at a time.
+class Optimizer {
+ public:
+  // Returns an optimizer with the given options, or reports an error and
+  // returns nullptr if the custom pipeline is not valid.
+  static std::unique_ptr<Optimizer> create(shared_ptr<Error> error,
+                                           const OptimizeOptions& options);
+
+  // Runs the pipeline on the given module.
+  void optimize(llvm::Module* module);
+
+ private:
+  Optimizer(const OptimizeOptions& options);
+
+  // Adds the passes of our pipeline to the given pass manager.
+  llvm::Error build(llvm::ModulePassManager& passes);
+
+  // Times each pass that runs, excluding the passes nested in it, and adds
+  // a span for it to the trace if we are tracing.
+  void time_passes();
+
+  // A pass we are timing. Passes nest, so we keep a stack of them.
+  struct PassTimer {
+    string name;
+
+    // The function or module the pass runs on, if we are tracing
+    string detail;
+
+    // When the pass started, for the trace
+    double begin;
+
+    // When we last started or resumed the timer of the pass
+    double wall;
+    double cpu;
+  };
+
+  OptimizeOptions options_;
+  llvm::PassInstrumentationCallbacks instrumentation_;
+  vector<PassTimer> pass_timers_;
+
+  // The exclusive times of each pass in the module we are optimizing
+  map<string, std::pair<double, double>> pass_times_;
+
+  llvm::PassBuilder builder_;
+  llvm::LoopAnalysisManager loop_analyses_;
+  llvm::FunctionAnalysisManager function_analyses_;
+  llvm::CGSCCAnalysisManager cgscc_analyses_;
+  llvm::ModuleAnalysisManager module_analyses_;
+};
 
 }
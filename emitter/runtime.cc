@@ -0,0 +1,285 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime.h"
+
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include "../runtime/output.h"
+
+namespace compiler::emitter {
+
+// The size of the output buffer, which matches runtime/output.cc
+static const uint64_t buffer_capacity = 64 * 1024;
+
+// The name of the runtime function that writes the buffer to stdout
+static const char flush_function[] = "compiler.flush";
+
+// Defines an internal global variable with the given initial value.
+static llvm::GlobalVariable* define_global(llvm::Module* llvm_module,
+                                           const string& name,
+                                           llvm::Constant* value,
+                                           bool constant = false) {
+  auto global = llvm::cast<llvm::GlobalVariable>(
+      llvm_module->getOrInsertGlobal(name, value->getType()));
+  global->setLinkage(llvm::GlobalValue::InternalLinkage);
+  global->setInitializer(value);
+  global->setConstant(constant);
+  return global;
+}
+
+// The value of EINTR in the C library of every target we support
+static const int interrupted = 4;
+
+// Declares the C library function that returns the address of errno on the
+// module's target, or on this machine if the module has no target.
+static llvm::FunctionCallee declare_errno(llvm::Module* llvm_module) {
+  auto& context = llvm_module->getContext();
+  auto triple = llvm::Triple(llvm_module->getTargetTriple().empty()
+                                 ? llvm::sys::getDefaultTargetTriple()
+                                 : llvm_module->getTargetTriple());
+  const char* name = "__errno_location";
+  if (triple.isOSDarwin() || triple.isOSFreeBSD() ||
+      triple.isOSDragonFly()) {
+    name = "__error";
+  } else if (triple.isOSOpenBSD() || triple.isOSNetBSD()) {
+    name = "__errno";
+  } else if (triple.isOSWindows()) {
+    name = "_errno";
+  }
+  return llvm_module->getOrInsertFunction(
+      name, llvm::FunctionType::get(
+                llvm::Type::getInt32Ty(context)->getPointerTo(), {}, false));
+}
+
+llvm::FunctionCallee declare_print(llvm::Module* llvm_module) {
+  auto& context = llvm_module->getContext();
+  return llvm_module->getOrInsertFunction(
+      print_function,
+      llvm::FunctionType::get(llvm::Type::getVoidTy(context),
+                              {llvm::Type::getInt64Ty(context)}, false));
+}
+
+void emit_write(llvm::IRBuilder<>& builder, llvm::Module* llvm_module,
+                llvm::GlobalVariable* data, llvm::Value* size) {
+  auto& context = llvm_module->getContext();
+  auto size_type = llvm_module->getDataLayout().getIntPtrType(context);
+  auto write = llvm_module->getOrInsertFunction(
+      "write", llvm::FunctionType::get(
+                   size_type,
+                   {builder.getInt32Ty(), builder.getInt8PtrTy(), size_type},
+                   false));
+
+  auto function = builder.GetInsertBlock()->getParent();
+  auto entry = builder.GetInsertBlock();
+  auto loop = llvm::BasicBlock::Create(context, "loop", function);
+  auto call = llvm::BasicBlock::Create(context, "write", function);
+  auto wrote = llvm::BasicBlock::Create(context, "wrote", function);
+  auto failed = llvm::BasicBlock::Create(context, "failed", function);
+  auto interrupt = llvm::BasicBlock::Create(context, "interrupt", function);
+  auto done = llvm::BasicBlock::Create(context, "done", function);
+  builder.CreateBr(loop);
+
+  builder.SetInsertPoint(loop);
+  auto written = builder.CreatePHI(builder.getInt64Ty(), 3);
+  written->addIncoming(builder.getInt64(0), entry);
+  builder.CreateCondBr(builder.CreateICmpULT(written, size), call, done);
+
+  builder.SetInsertPoint(call);
+  auto bytes = builder.CreateInBoundsGEP(data->getValueType(), data,
+                                         {builder.getInt64(0), written});
+  auto result = builder.CreateCall(
+      write, {builder.getInt32(1), bytes,
+              builder.CreateZExtOrTrunc(builder.CreateSub(size, written),
+                                        size_type)});
+  auto count = builder.CreateSExtOrTrunc(result, builder.getInt64Ty());
+  builder.CreateCondBr(builder.CreateICmpSGT(count, builder.getInt64(0)),
+                       wrote, failed);
+
+  builder.SetInsertPoint(wrote);
+  written->addIncoming(builder.CreateAdd(written, count), wrote);
+  builder.CreateBr(loop);
+
+  // Retry writes that a signal interrupted, like runtime::flush
+  builder.SetInsertPoint(failed);
+  builder.CreateCondBr(builder.CreateICmpSLT(count, builder.getInt64(0)),
+                       interrupt, done);
+  builder.SetInsertPoint(interrupt);
+  auto error_number = builder.CreateLoad(
+      builder.getInt32Ty(), builder.CreateCall(declare_errno(llvm_module)));
+  written->addIncoming(written, interrupt);
+  builder.CreateCondBr(
+      builder.CreateICmpEQ(error_number, builder.getInt32(interrupted)), loop,
+      done);
+  builder.SetInsertPoint(done);
+}
+
+// Emits a function that writes the buffer to stdout and empties it.
+static llvm::Function* emit_flush(llvm::Module* llvm_module,
+                                  llvm::GlobalVariable* buffer,
+                                  llvm::GlobalVariable* buffer_size) {
+  auto& context = llvm_module->getContext();
+  llvm::IRBuilder<> builder(context);
+  auto flush = llvm::Function::Create(
+      llvm::FunctionType::get(builder.getVoidTy(), {}, false),
+      llvm::Function::InternalLinkage, flush_function, llvm_module);
+  flush->addFnAttr(llvm::Attribute::NoInline);
+  builder.SetInsertPoint(llvm::BasicBlock::Create(context, "", flush));
+  emit_write(builder, llvm_module, buffer,
+             builder.CreateLoad(builder.getInt64Ty(), buffer_size));
+  builder.CreateStore(builder.getInt64(0), buffer_size);
+  builder.CreateRetVoid();
+  llvm::verifyFunction(*flush);
+  return flush;
+}
+
+// Emits the body of the print function, which formats the value right to
+// left two digits at a time with a table of the digits of 0 to 99, exactly
+// like runtime::print.
+static void emit_print(llvm::Module* llvm_module, llvm::Function* flush,
+                       llvm::GlobalVariable* buffer,
+                       llvm::GlobalVariable* buffer_size) {
+  auto& context = llvm_module->getContext();
+  llvm::IRBuilder<> builder(context);
+  string pairs;
+  for (int i = 0; i < 100; i++) {
+    pairs += static_cast<char>('0' + i / 10);
+    pairs += static_cast<char>('0' + i % 10);
+  }
+  auto digit_pairs = define_global(
+      llvm_module, "compiler.digit_pairs",
+      llvm::ConstantDataArray::getString(context, pairs, false), true);
+
+  auto print = llvm::cast<llvm::Function>(
+      declare_print(llvm_module).getCallee());
+  print->addFnAttr(llvm::Attribute::NoInline);
+  print->addFnAttr(llvm::Attribute::NoUnwind);
+  auto entry = llvm::BasicBlock::Create(context, "", print);
+  auto full = llvm::BasicBlock::Create(context, "full", print);
+  auto format = llvm::BasicBlock::Create(context, "format", print);
+  auto loop = llvm::BasicBlock::Create(context, "loop", print);
+  auto pair = llvm::BasicBlock::Create(context, "pair", print);
+  auto last = llvm::BasicBlock::Create(context, "last", print);
+
+  // Make room for the longest line
+  builder.SetInsertPoint(entry);
+  auto digits_type =
+      llvm::ArrayType::get(builder.getInt8Ty(), runtime::max_line - 1);
+  auto digits = builder.CreateAlloca(digits_type);
+  auto size = builder.CreateLoad(builder.getInt64Ty(), buffer_size);
+  builder.CreateCondBr(
+      builder.CreateICmpUGT(
+          size, builder.getInt64(buffer_capacity - runtime::max_line)),
+      full, format);
+  builder.SetInsertPoint(full);
+  builder.CreateCall(flush);
+  builder.CreateBr(format);
+
+  builder.SetInsertPoint(format);
+  auto start = builder.CreatePHI(builder.getInt64Ty(), 2);
+  start->addIncoming(size, entry);
+  start->addIncoming(builder.getInt64(0), full);
+  auto value = print->getArg(0);
+  auto negative = builder.CreateICmpSLT(value, builder.getInt64(0));
+  auto magnitude =
+      builder.CreateSelect(negative, builder.CreateNeg(value), value);
+  builder.CreateBr(loop);
+
+  // Copies the digits of `number`, which is less than 100, to the two
+  // bytes before `position` in the digits array
+  auto copy_pair = [&](llvm::Value* number, llvm::Value* position) {
+    auto destination = builder.CreateInBoundsGEP(
+        digits_type, digits, {builder.getInt64(0), position});
+    auto source = builder.CreateInBoundsGEP(
+        digit_pairs->getValueType(), digit_pairs,
+        {builder.getInt64(0), builder.CreateShl(number, 1)});
+    builder.CreateMemCpy(destination, llvm::MaybeAlign(1), source,
+                         llvm::MaybeAlign(1), 2);
+  };
+
+  builder.SetInsertPoint(loop);
+  auto remaining = builder.CreatePHI(builder.getInt64Ty(), 2);
+  auto position = builder.CreatePHI(builder.getInt64Ty(), 2);
+  remaining->addIncoming(magnitude, format);
+  position->addIncoming(builder.getInt64(runtime::max_line - 1), format);
+  builder.CreateCondBr(
+      builder.CreateICmpUGE(remaining, builder.getInt64(100)), pair, last);
+
+  builder.SetInsertPoint(pair);
+  auto quotient = builder.CreateUDiv(remaining, builder.getInt64(100));
+  auto next = builder.CreateSub(position, builder.getInt64(2));
+  copy_pair(builder.CreateSub(remaining, builder.CreateMul(
+                                             quotient, builder.getInt64(100))),
+            next);
+  remaining->addIncoming(quotient, pair);
+  position->addIncoming(next, pair);
+  builder.CreateBr(loop);
+
+  // Write the last pair even if a single digit remains, and skip its leading
+  // zero. We always store a sign before the digits, and include it only if
+  // the value is negative.
+  builder.SetInsertPoint(last);
+  auto first = builder.CreateSub(position, builder.getInt64(2));
+  copy_pair(remaining, first);
+  first = builder.CreateAdd(
+      first, builder.CreateZExt(
+                 builder.CreateICmpULT(remaining, builder.getInt64(10)),
+                 builder.getInt64Ty()));
+  auto digit = [&](llvm::Value* index) {
+    return builder.CreateInBoundsGEP(digits_type, digits,
+                                     {builder.getInt64(0), index});
+  };
+  builder.CreateStore(builder.getInt8('-'),
+                      digit(builder.CreateSub(first, builder.getInt64(1))));
+  first = builder.CreateSub(first,
+                            builder.CreateZExt(negative, builder.getInt64Ty()));
+
+  // Append the digits and a newline to the buffer
+  auto length =
+      builder.CreateSub(builder.getInt64(runtime::max_line - 1), first);
+  auto output = [&](llvm::Value* index) {
+    return builder.CreateInBoundsGEP(buffer->getValueType(), buffer,
+                                     {builder.getInt64(0), index});
+  };
+  builder.CreateMemCpy(output(start), llvm::MaybeAlign(1), digit(first),
+                       llvm::MaybeAlign(1), length);
+  auto newline = builder.CreateAdd(start, length);
+  builder.CreateStore(builder.getInt8('\n'), output(newline));
+  builder.CreateStore(builder.CreateAdd(newline, builder.getInt64(1)),
+                      buffer_size);
+  builder.CreateRetVoid();
+  llvm::verifyFunction(*print);
+}
+
+void emit_runtime(llvm::Module* llvm_module) {
+  auto& context = llvm_module->getContext();
+  auto buffer_type =
+      llvm::ArrayType::get(llvm::Type::getInt8Ty(context), buffer_capacity);
+  auto buffer = define_global(llvm_module, "compiler.buffer",
+                              llvm::ConstantAggregateZero::get(buffer_type));
+  auto buffer_size = define_global(
+      llvm_module, "compiler.buffer_size",
+      llvm::ConstantInt::get(llvm::Type::getInt64Ty(context), 0));
+  auto flush = emit_flush(llvm_module, buffer, buffer_size);
+  emit_print(llvm_module, flush, buffer, buffer_size);
+
+  // Write what is left in the buffer when the program exits
+  llvm::appendToGlobalDtors(*llvm_module, flush, 0);
+}
+
+}
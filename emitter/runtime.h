@@ -0,0 +1,44 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+#include "../core/common.h"
+
+namespace compiler::emitter {
+
+// The name of the runtime function that prints a value and a newline
+inline constexpr char print_function[] = "compiler.print";
+
+// Declares the runtime function that prints an i64 value and a newline.
+llvm::FunctionCallee declare_print(llvm::Module* llvm_module);
+
+// Defines the runtime in the given module, which formats values into a large
+// buffer and writes it to stdout when it fills and when the program exits.
+// Every program we link needs exactly one module with the runtime. Code we
+// run with the JIT uses runtime::print instead, so its output is ordered
+// with the output of the other engines.
+void emit_runtime(llvm::Module* llvm_module);
+
+// Emits code at the builder's insertion point that writes the first `size`
+// bytes of the given array to stdout with write(2), until they are all
+// written or write fails for a reason other than a signal. The builder is
+// left at the end of that code.
+void emit_write(llvm::IRBuilder<>& builder, llvm::Module* llvm_module,
+                llvm::GlobalVariable* data, llvm::Value* size);
+
+}
@@ -24,4 +24,21 @@ void IntegerLiteral::handle(Expression::Handler& handler) {
   handler.handle_integer_literal(*this);
 }
 
+const vector<Expression*>& Module::tree() {
+  for (NodeTable::Index i = tree_nodes_.size(); i < nodes.size(); i++) {
+    if (nodes.is_binary(i)) {
+      tree_nodes_.push_back(arena_.create<Binary>(
+          nodes.locations[i], tree_nodes_[nodes.lhs[i]],
+          Binary::Operator(nodes.opcodes[i]), tree_nodes_[nodes.rhs[i]]));
+    } else {
+      tree_nodes_.push_back(
+          arena_.create<IntegerLiteral>(nodes.locations[i], nodes.value(i)));
+    }
+  }
+  for (size_t i = tree_.size(); i < expressions.size(); i++) {
+    tree_.push_back(tree_nodes_[expressions[i]]);
+  }
+  return tree_;
+}
+
 }
@@ -14,71 +14,93 @@
 
 #pragma once
 
+#include <functional>
+#include <type_traits>
+
+#include "../core/arena.h"
 #include "../core/common.h"
 #include "../core/location.h"
+#include "table.h"
 
 namespace compiler::parser {
 
-// A node in the program's abstract syntax tree.
+// A node in the program's pointer-based abstract syntax tree. The grammar
+// records programs in a NodeTable, and Module::tree() builds these nodes from
+// the table for passes that use Expression::Visitor or Expression::Handler.
+// Nodes are allocated in the Arena of the Module that contains them, and they
+// refer to each other with plain pointers that are valid for the lifetime of
+// the Module.
 class AST {
  public:
-  virtual ~AST() {
-  }
-
   // The file location of this node in the program.
   Location location;
 
  protected:
   AST(const Location& location) : location(location) {
   }
+
+  // Nodes are only ever destroyed by their Arena, never through a base class
+  // pointer, which keeps them trivially destructible when their fields are.
+  ~AST() = default;
 };
 
 // A node that expresses a value.
 class Expression : public AST {
  public:
   class Handler;
+  template <typename Derived, typename Result = void>
+  class Visitor;
+
+  // The concrete type of an expression, which Visitor dispatches on.
+  enum Kind : uint8_t {
+    BINARY,
+    INTEGER_LITERAL,
+  };
 
   // Dynamically dispatch based on the runtime type of this expression.
   virtual void handle(Handler& handler) = 0;
 
+  const Kind kind;
+
  protected:
-  Expression(const Location& location) : AST(location) {
+  Expression(const Location& location, Kind kind)
+      : AST(location), kind(kind) {
   }
 };
 
 // A binary operation on two expressions.
-class Binary : public Expression {
+class Binary final : public Expression {
  public:
   enum Operator {
-    ADD,
-    SUBTRACT,
-    DIVIDE,
-    MULTIPLY,
-    MOD,
-    SHIFT_LEFT,
-    SHIFT_RIGHT,
-    BIT_AND,
-    BIT_OR,
-    BIT_XOR,
+    ADD = NodeTable::ADD,
+    SUBTRACT = NodeTable::SUBTRACT,
+    DIVIDE = NodeTable::DIVIDE,
+    MULTIPLY = NodeTable::MULTIPLY,
+    MOD = NodeTable::MOD,
+    SHIFT_LEFT = NodeTable::SHIFT_LEFT,
+    SHIFT_RIGHT = NodeTable::SHIFT_RIGHT,
+    BIT_AND = NodeTable::BIT_AND,
+    BIT_OR = NodeTable::BIT_OR,
+    BIT_XOR = NodeTable::BIT_XOR,
   };
 
-  Binary(const Location& location, shared_ptr<Expression> lhs, Operator op,
-         shared_ptr<Expression> rhs)
-      : Expression(location), lhs(lhs), op(op), rhs(rhs) {
+  Binary(const Location& location, Expression* lhs, Operator op,
+         Expression* rhs)
+      : Expression(location, BINARY), lhs(lhs), op(op), rhs(rhs) {
   }
 
   void handle(Handler& handler) override;
 
-  shared_ptr<Expression> lhs;
+  Expression* lhs;
   Operator op;
-  shared_ptr<Expression> rhs;
+  Expression* rhs;
 };
 
 // A 64-bit integer constant.
-class IntegerLiteral : public Expression {
+class IntegerLiteral final : public Expression {
  public:
   IntegerLiteral(const Location& location, int64_t value)
-      : Expression(location), value(value) {
+      : Expression(location, INTEGER_LITERAL), value(value) {
   }
 
   void handle(Handler& handler) override;
@@ -86,13 +108,55 @@ class IntegerLiteral : public Expression {
   int64_t value;
 };
 
+// Nodes are released with their Arena without running destructors, so
+// tearing down even the deepest tree never recurses.
+static_assert(std::is_trivially_destructible_v<Binary> &&
+              std::is_trivially_destructible_v<IntegerLiteral>);
+
+// Receives each top-level expression from a streaming parse as soon as it
+// has been parsed. `input_pending` is false if the parser would have to wait
+// for more input, e.g., from a pipe, before parsing another expression.
+using Consumer = std::function<void(
+    const NodeTable& nodes, NodeTable::Index expression, bool input_pending)>;
+
+// A parsed source file.
 class Module {
  public:
   Module(const filesystem::path& path) : path(path) {
   }
 
+  // Returns the pointer-based tree for each top-level expression, building
+  // nodes from the table the first time they are requested.
+  const vector<Expression*>& tree();
+
   filesystem::path path;
-  vector<shared_ptr<Expression>> expressions;
+
+  // The root node of each top-level expression, in source order.
+  vector<NodeTable::Index> expressions;
+  NodeTable nodes;
+
+  // A line of the source, which contains at most one top-level expression.
+  struct Line {
+    static const NodeTable::Index NONE = UINT32_MAX;
+
+    // The hash of the line's bytes, including its newline.
+    uint64_t hash;
+    uint64_t offset;
+    NodeTable::Index expression;
+  };
+
+  // Every line of the source, if this Module was built by reparse().
+  vector<Line> lines;
+
+  // The text of a Module built by reparse(), which the next call compares
+  // lines against, and the file its locations refer to.
+  shared_ptr<const string> text;
+  FileID file = 0;
+
+ private:
+  Arena arena_;
+  vector<Expression*> tree_nodes_;
+  vector<Expression*> tree_;
 };
 
 class Expression::Handler {
@@ -104,4 +168,22 @@ class Expression::Handler {
   virtual void handle_integer_literal(IntegerLiteral&) = 0;
 };
 
+// Statically dispatches on Expression::kind to the visit_binary and
+// visit_integer_literal methods of `Derived`, which subclasses this template
+// and returns `Result` from each method. Unlike Handler, there are no virtual
+// calls, so the compiler can inline each method into visit(), and a method
+// can visit the children of a node by calling visit() recursively.
+template <typename Derived, typename Result>
+class Expression::Visitor {
+ public:
+  Result visit(Expression& expression) {
+    auto& derived = static_cast<Derived&>(*this);
+    if (expression.kind == BINARY) {
+      return derived.visit_binary(static_cast<Binary&>(expression));
+    }
+    return derived.visit_integer_literal(
+        static_cast<IntegerLiteral&>(expression));
+  }
+};
+
 }
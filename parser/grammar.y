@@ -17,7 +17,11 @@
 %{
 
 #include "grammar.h"
+#ifdef SIMD_SCANNER
+#include "simd_scanner.h"
+#else
 #include "scanner.h"
+#endif
 
 %}
 
@@ -32,34 +36,50 @@
 %locations
 
 %code requires {
-  #include <iostream>
   #include "../core/error.h"
+  #include "../core/source.h"
   #include "ast.h"
 }
 
 %code provides {
   namespace compiler::parser {
     struct State {
-      std::istream& input;
-      Position position;
+      Source& source;
+      FileID file;
+      uint64_t offset;
       shared_ptr<Error> error;
+
+      // Null if we are only recognizing syntax, in which case the scanner
+      // does not record integer literals.
       shared_ptr<Module> module;
+      const Consumer* consume;
     };
   }
 
+  #define YYLLOC_DEFAULT(Current, Rhs, N) \
+    do { \
+      if (N) { \
+        (Current) = Location::span(YYRHSLOC(Rhs, 1), YYRHSLOC(Rhs, N)); \
+      } else { \
+        (Current) = YYRHSLOC(Rhs, 0); \
+        (Current).begin = (Current).end(); \
+        (Current).length = 0; \
+      } \
+    } while (false)
+
   typedef compiler::parser::Grammar::semantic_type YYSTYPE;
   typedef compiler::parser::Grammar::location_type YYLTYPE;
   #define YY_EXTRA_TYPE compiler::parser::State*
 }
 
-%token<shared_ptr<IntegerLiteral>> IntegerLiteral;
+%token<NodeTable::Index> IntegerLiteral;
 
 %token OperatorShiftLeft
 %token OperatorShiftRight
 
-%nterm<shared_ptr<Binary>> Binary
-%nterm<shared_ptr<Expression>> Expression
-%nterm<shared_ptr<Module>> Module
+%nterm<NodeTable::Index> Binary
+%nterm<NodeTable::Index> Expression
+%nterm<Module*> Module
 
 %left '+' '-'
 %left '*' '/' '%'
@@ -69,14 +89,19 @@
 
 Module: Module Expression '\n' {
   $$ = $1;
-  $$->expressions.push_back($2);
+  auto state = yyget_extra(yyscanner);
+  if (state->consume) {
+    // This reduction never needs a lookahead token, so no nodes beyond this
+    // expression have been scanned yet.
+    (*state->consume)($$->nodes, $2, state->source.ready());
+    $$->nodes.clear();
+  } else {
+    $$->expressions.push_back($2);
+  }
 } | Module '\n' {
   $$ = $1;
 } | {
-  auto state = yyget_extra(yyscanner);
-  auto module = make_shared<Module>(*state->position.path);
-  state->module = module;
-  $$ = module;
+  $$ = yyget_extra(yyscanner)->module.get();
 }
 
 Expression: Binary {
@@ -85,29 +110,39 @@ Expression: Binary {
   $$ = $1;
 } | '(' Expression ')' {
   $$ = $2;
-  $$->location = @$;
+  yyget_extra(yyscanner)->module->nodes.set_location($$, @$);
 }
 
 Binary: Expression '+' Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::ADD, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::ADD, $3);
 } | Expression '-' Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::SUBTRACT, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::SUBTRACT, $3);
 } | Expression '*' Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::MULTIPLY, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::MULTIPLY, $3);
 } | Expression '/' Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::DIVIDE, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::DIVIDE, $3);
 } | Expression '%' Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::MOD, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::MOD, $3);
 } | Expression OperatorShiftLeft Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::SHIFT_LEFT, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::SHIFT_LEFT, $3);
 } | Expression OperatorShiftRight Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::SHIFT_RIGHT, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::SHIFT_RIGHT, $3);
 } | Expression '&' Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::BIT_AND, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::BIT_AND, $3);
 } | Expression '|' Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::BIT_OR, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::BIT_OR, $3);
 } | Expression '^' Expression {
-  $$ = make_shared<Binary>(@$, $1, Binary::BIT_XOR, $3);
+  $$ = yyget_extra(yyscanner)->module->nodes.add_binary(
+      @$, $1, NodeTable::BIT_XOR, $3);
 }
 
 %%
@@ -14,41 +14,456 @@
 
 #include "parse.h"
 
-#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <utf8.h>
 
+#include "../core/source.h"
+#include "../core/thread_pool.h"
+
 #include "grammar.h"
+#include "pratt.h"
+#ifdef SIMD_SCANNER
+#include "simd_scanner.h"
+#else
 #include "scanner.h"
+#endif
 
 extern int yyparse(void*);
 
 namespace compiler::parser {
 
-shared_ptr<Module> parse(shared_ptr<Error> error,
-                         const filesystem::path& path) {
-  std::ifstream input(path);
-  if (!input) {
+// The smallest piece of a file we parse on its own thread.
+static const size_t min_chunk_size = 1024 * 1024;
+
+// Runs the parser over the given source, which starts at `offset` in `file`.
+// If `consume` is given, we pass each top-level expression to it rather than
+// accumulating them in the Module. We ignore `options.jobs`.
+static shared_ptr<Module> parse(shared_ptr<Error> error,
+                                const filesystem::path& path, Source& source,
+                                FileID file, uint64_t offset,
+                                const Consumer* consume,
+                                const ParseOptions& options = ParseOptions()) {
+  State state{
+      .source = source,
+      .file = file,
+      .offset = offset,
+      .error = error,
+      .module = make_shared<Module>(path),
+      .consume = consume,
+  };
+  if (options.share) {
+    state.module->nodes.enable_sharing();
+  }
+  yyscan_t scanner;
+  yylex_init_extra(&state, &scanner);
+  int result = -1;
+  try {
+    if (options.pratt) {
+      result = PrattParser(scanner).parse();
+    } else {
+      result = Grammar(scanner).parse();
+    }
+  } catch (const utf8::exception&) {
+    error->report(Error::ERROR,
+                  path.string() + " contains invalid UTF-8 characters");
+  } catch (const std::length_error&) {
+    error->report(Error::ERROR,
+                  path.string() + " contains too many expressions");
+  }
+  yylex_destroy(scanner);
+  if (source.failed()) {
+    error->report(Error::ERROR, "Could not read " + path.string());
+    return nullptr;
+  }
+  return result == 0 ? state.module : nullptr;
+}
+
+// Splits a mapped source into at most `count` ranges of whole lines,
+// returning the offset at which each range begins.
+static vector<size_t> split_lines(const Source& source, size_t count) {
+  vector<size_t> offsets{0};
+  for (size_t i = 1; i < count; i++) {
+    size_t target = std::max(source.size() * i / count, offsets.back());
+    auto newline = static_cast<const char*>(memchr(
+        source.data() + target, '\n', source.size() - target));
+    if (!newline || newline + 1 == source.data() + source.size()) {
+      break;
+    }
+    size_t offset = newline + 1 - source.data();
+    if (offset > offsets.back()) {
+      offsets.push_back(offset);
+    }
+  }
+  return offsets;
+}
+
+// Parses a mapped source in chunks of whole lines on separate threads, and
+// merges the results in source order. Top-level expressions never span
+// lines, so each chunk parses exactly as it would as part of the whole file.
+// We report each chunk's diagnostics in order and stop at the first chunk
+// with an error, so diagnostics are identical to a serial parse.
+static shared_ptr<Module> parse_chunks(shared_ptr<Error> error,
+                                       const filesystem::path& path,
+                                       Source& source, FileID file,
+                                       const vector<size_t>& offsets,
+                                       const ParseOptions& options) {
+  auto count = offsets.size();
+  vector<shared_ptr<Module>> chunks(count);
+  vector<shared_ptr<Error::Buffer>> errors(count);
+  ThreadPool pool(count);
+  pool.run(count, [&](size_t i) {
+    Timing::Span span(options.timing, "parse chunk", path);
+    auto end = i + 1 < count ? offsets[i + 1] : source.size();
+    Source chunk(path, source.data() + offsets[i], end - offsets[i]);
+    errors[i] = make_shared<Error::Buffer>();
+    chunks[i] =
+        parse(errors[i], path, chunk, file, offsets[i], nullptr, options);
+  });
+
+  // If nodes are shared, we add each node of a chunk to the merged table
+  // again, so nodes identical to those of earlier chunks are shared too, and
+  // the table matches that of a serial parse
+  Timing::Span span(options.timing, "merge chunks", path);
+  auto module = make_shared<Module>(path);
+  if (options.share) {
+    module->nodes.enable_sharing();
+  }
+  vector<NodeTable::Index> indices;
+  for (size_t i = 0; i < count; i++) {
+    errors[i]->flush(*error);
+    if (!chunks[i]) {
+      return nullptr;
+    }
+    try {
+      auto& nodes = chunks[i]->nodes;
+      if (options.share) {
+        module->nodes.append_shared(nodes, indices);
+        for (auto expression : chunks[i]->expressions) {
+          module->expressions.push_back(indices[expression]);
+        }
+      } else {
+        auto base = module->nodes.append(nodes, 0, nodes.size(), 0, file);
+        for (auto expression : chunks[i]->expressions) {
+          module->expressions.push_back(base + expression);
+        }
+      }
+    } catch (const std::length_error&) {
+      error->report(Error::ERROR,
+                    path.string() + " contains too many expressions");
+      return nullptr;
+    }
+    chunks[i].reset();
+  }
+  return module;
+}
+
+shared_ptr<Module> parse(shared_ptr<Error> error, const filesystem::path& path,
+                         const ParseOptions& options) {
+  auto file = SourceManager::shared().add(path);
+  Source source(path, file);
+  if (!source.is_open()) {
+    error->report(Error::ERROR, "Could not open " + path.string());
+    return nullptr;
+  }
+  auto jobs = options.jobs;
+  if (jobs == 0) {
+    jobs = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  size_t count = std::min<size_t>(jobs, source.size() / min_chunk_size);
+  if (source.is_mapped() && count > 1) {
+    auto offsets = split_lines(source, count);
+    if (offsets.size() > 1) {
+      return parse_chunks(error, path, source, file, offsets, options);
+    }
+  }
+  return parse(error, path, source, file, 0, nullptr, options);
+}
+
+bool parse(shared_ptr<Error> error, const filesystem::path& path,
+           const Consumer& consume, const ParseOptions& options) {
+  auto file = SourceManager::shared().add(path);
+  Source source(path, file);
+  if (!source.is_open()) {
     error->report(Error::ERROR, "Could not open " + path.string());
+    return false;
+  }
+  ParseOptions incremental;
+  incremental.pratt = options.pratt;
+
+  // Diagnostics for later expressions never refer to the lines before this
+  // one, so we let the SourceManager forget them
+  Consumer release = [&](const NodeTable& nodes, NodeTable::Index expression,
+                         bool input_pending) {
+    consume(nodes, expression, input_pending);
+    SourceManager::shared().release(file, nodes.locations[expression].begin);
+  };
+  return parse(error, path, source, file, 0, &release, incremental) != nullptr;
+}
+
+// Returns the bytes of the given line of a Module built by reparse().
+static std::string_view line_text(const Module& module, size_t line) {
+  auto& lines = module.lines;
+  auto end = line + 1 < lines.size() ? lines[line + 1].offset
+                                     : module.text->size();
+  return std::string_view(module.text->data() + lines[line].offset,
+                          end - lines[line].offset);
+}
+
+shared_ptr<Module> reparse(shared_ptr<Error> error,
+                           const filesystem::path& path, const string& text,
+                           shared_ptr<const Module> previous) {
+  auto module = make_shared<Module>(path);
+  module->text = make_shared<const string>(text);
+  auto& lines = module->lines;
+  if (previous) {
+    lines.reserve(previous->lines.size());
+    module->nodes.reserve(previous->nodes.size(),
+                          previous->nodes.values.size());
+  }
+
+  // Split the text into lines and hash them. Each line includes its newline,
+  // so a last line without one never matches a line that had one.
+  size_t offset = 0;
+  while (offset < text.size()) {
+    auto newline = static_cast<const char*>(
+        memchr(text.data() + offset, '\n', text.size() - offset));
+    size_t end = newline ? newline + 1 - text.data() : text.size();
+    auto hash = std::hash<std::string_view>()(
+        std::string_view(text.data() + offset, end - offset));
+    lines.push_back(Module::Line{hash, offset, Module::Line::NONE});
+    offset = end;
+  }
+
+  // Successive versions of the text share a file, so editing does not
+  // register a new one each time
+  auto& sources = SourceManager::shared();
+  if (previous && previous->text) {
+    module->file = previous->file;
+    sources.update(module->file, module->text);
+  } else {
+    module->file = sources.add(path, module->text);
+  }
+  auto file = module->file;
+
+  // The previous version parsed without errors, so any line we saw before
+  // parses the same way again, wherever it is now. Edits are usually
+  // local, so we match the lines before and after the edited region in
+  // order, and only look up the lines in between by their bytes.
+  size_t prefix = 0;
+  size_t suffix = 0;
+  std::unordered_map<std::string_view, const Module::Line*> moved;
+  if (previous && previous->text) {
+    auto& old_lines = previous->lines;
+    auto same = [&](size_t line, size_t old_line) {
+      return lines[line].hash == old_lines[old_line].hash &&
+             line_text(*module, line) == line_text(*previous, old_line);
+    };
+    auto common = std::min(lines.size(), old_lines.size());
+    while (prefix < common && same(prefix, prefix)) {
+      prefix++;
+    }
+    while (suffix < common - prefix &&
+           same(lines.size() - suffix - 1, old_lines.size() - suffix - 1)) {
+      suffix++;
+    }
+    for (size_t i = prefix; i < old_lines.size() - suffix; i++) {
+      moved.emplace(line_text(*previous, i), &old_lines[i]);
+    }
+  }
+  auto find_unchanged = [&](size_t i) -> const Module::Line* {
+    if (i < prefix) {
+      return &previous->lines[i];
+    } else if (i >= lines.size() - suffix) {
+      return &previous->lines[i + previous->lines.size() - lines.size()];
+    }
+    auto match = moved.find(line_text(*module, i));
+    return match == moved.end() ? nullptr : match->second;
+  };
+
+  // Copies runs of reused expressions that are adjacent in the previous
+  // table and have moved by the same number of bytes all at once
+  NodeTable::Index copy_begin = 0;
+  NodeTable::Index copy_end = 0;
+  int64_t copy_shift = 0;
+  auto copy = [&]() {
+    if (copy_begin < copy_end) {
+      module->nodes.append(previous->nodes, copy_begin, copy_end, copy_shift,
+                           file);
+      copy_begin = copy_end = 0;
+    }
+  };
+
+  // Parses the lines in [begin, end), which have changed
+  auto parse_lines = [&](size_t begin, size_t end) {
+    copy();
+    auto offset = lines[begin].offset;
+    auto size = (end < lines.size() ? lines[end].offset : text.size()) - offset;
+    Source chunk(path, text.data() + offset, size);
+    auto parsed = parse(error, path, chunk, file, offset, nullptr);
+    if (!parsed) {
+      return false;
+    }
+    auto base = module->nodes.append(parsed->nodes, 0, parsed->nodes.size(), 0,
+                                     file);
+    auto line = begin;
+    for (auto expression : parsed->expressions) {
+      auto location = parsed->nodes.locations[expression].begin;
+      while (line + 1 < end && lines[line + 1].offset <= location) {
+        line++;
+      }
+      lines[line].expression = base + expression;
+      module->expressions.push_back(base + expression);
+    }
+    return true;
+  };
+
+  try {
+    size_t changed = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+      auto match = find_unchanged(i);
+      if (!match) {
+        continue;
+      }
+      if (changed < i && !parse_lines(changed, i)) {
+        return nullptr;
+      }
+      changed = i + 1;
+
+      auto root = match->expression;
+      if (root == Module::Line::NONE) {
+        continue;
+      }
+      auto first = previous->nodes.first(root);
+      int64_t shift = lines[i].offset - match->offset;
+      if (copy_begin == copy_end || first != copy_end || shift != copy_shift) {
+        copy();
+        copy_begin = copy_end = first;
+        copy_shift = shift;
+      }
+      lines[i].expression = module->nodes.size() + (root - copy_begin);
+      module->expressions.push_back(lines[i].expression);
+      copy_end = root + 1;
+    }
+    if (changed < lines.size() && !parse_lines(changed, lines.size())) {
+      return nullptr;
+    }
+    copy();
+  } catch (const std::length_error&) {
+    error->report(Error::ERROR,
+                  path.string() + " contains too many expressions");
     return nullptr;
   }
+  return module;
+}
 
+// Checks that the tokens of a file form a sequence of top-level expressions.
+// Expressions are operands separated by binary operators, where an operand
+// is a literal or a parenthesized expression, so a counter of open
+// parentheses and the kind of token we expect next are all the state we
+// need. We stop at the first token that cannot continue a valid program,
+// which is the same token the LALR parser reports, and the location we
+// pass to the scanner carries over between tokens just as it does in the
+// parser, so diagnostics are identical.
+static bool recognize(shared_ptr<Error> error, const filesystem::path& path,
+                      Source& source, FileID file) {
   State state{
-      .input = input,
-      .position{.path = make_shared<filesystem::path>(path)},
+      .source = source,
+      .file = file,
+      .offset = 0,
       .error = error,
+      .module = nullptr,
+      .consume = nullptr,
   };
   yyscan_t scanner;
   yylex_init_extra(&state, &scanner);
-  Grammar grammar(scanner);
-  int result = -1;
+  YYSTYPE value;
+  YYLTYPE location;
+  enum { LINE, OPERAND, OPERATOR } expected = LINE;
+  size_t depth = 0;
+  bool valid = true;
+  bool scanned = true;
   try {
-    result = grammar.parse();
+    while (valid) {
+      auto token = yylex(&value, &location, scanner);
+      if (expected == LINE) {
+        if (token == 0) {
+          break;
+        } else if (token == '\n') {
+          continue;
+        }
+        expected = OPERAND;
+      }
+      if (expected == OPERAND) {
+        if (token == Grammar::token::IntegerLiteral) {
+          expected = OPERATOR;
+        } else if (token == '(') {
+          depth++;
+        } else {
+          valid = false;
+        }
+        continue;
+      }
+      switch (token) {
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '%':
+        case '&':
+        case '|':
+        case '^':
+        case Grammar::token::OperatorShiftLeft:
+        case Grammar::token::OperatorShiftRight:
+          expected = OPERAND;
+          break;
+        case ')':
+          if (depth > 0) {
+            depth--;
+          } else {
+            valid = false;
+          }
+          break;
+        case '\n':
+          valid = depth == 0;
+          expected = LINE;
+          break;
+        default:
+          valid = false;
+          break;
+      }
+    }
   } catch (const utf8::exception&) {
     error->report(Error::ERROR,
                   path.string() + " contains invalid UTF-8 characters");
+    scanned = false;
   }
   yylex_destroy(scanner);
-  return result == 0 ? state.module : nullptr;
+  if (!scanned) {
+    return false;
+  } else if (!valid) {
+    error->report(Error::ERROR, location, "syntax error");
+  }
+  return valid;
+}
+
+bool recognize(shared_ptr<Error> error, const filesystem::path& path) {
+  auto file = SourceManager::shared().add(path);
+  Source source(path, file);
+  if (!source.is_open()) {
+    error->report(Error::ERROR, "Could not open " + path.string());
+    return false;
+  }
+  bool valid = recognize(error, path, source, file);
+  if (source.failed()) {
+    error->report(Error::ERROR, "Could not read " + path.string());
+    return false;
+  }
+  return valid;
 }
 
 }
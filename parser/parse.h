@@ -16,10 +16,69 @@
 
 #include "../core/common.h"
 #include "../core/error.h"
+#include "../core/timing.h"
 #include "ast.h"
 
 namespace compiler::parser {
 
-shared_ptr<Module> parse(shared_ptr<Error> error, const filesystem::path& path);
+struct ParseOptions {
+  // Large files are split at line boundaries and parsed on up to `jobs`
+  // threads, or one thread per core if `jobs` is zero. The resulting Module
+  // and any diagnostics are identical to those of a serial parse. By
+  // default we parse on the calling thread alone, so callers opt in with
+  // their own thread budget.
+  unsigned jobs = 1;
+
+  // Records structurally identical subexpressions in a single shared node;
+  // see NodeTable::enable_sharing. Files parsed on several threads share
+  // nodes across pieces as well, though `occurrences` may be recorded in a
+  // different order than in a serial parse.
+  bool share = false;
+
+  // Parses with the hand-written PrattParser rather than the Bison parser.
+  // Both produce identical Modules and diagnostics. The default is chosen at
+  // build time with the PRATT_PARSER option.
+#ifdef PRATT_PARSER
+  bool pratt = true;
+#else
+  bool pratt = false;
+#endif
+
+  // If not null and tracing, we add a span for each piece of a file parsed
+  // on its own thread and for merging the pieces.
+  Timing* timing = nullptr;
+};
+
+// Parses the file at the given path, returning nullptr if there were errors.
+shared_ptr<Module> parse(shared_ptr<Error> error, const filesystem::path& path,
+                         const ParseOptions& options = ParseOptions());
+
+// Parses the file at the given path incrementally, passing each top-level
+// expression to `consume` and releasing its nodes as soon as `consume`
+// returns, so memory use does not grow with the size of the input. Returns
+// false if there were errors, in which case expressions that precede the
+// error have already been consumed. Only the parser choice in `options`
+// applies to incremental parsing.
+bool parse(shared_ptr<Error> error, const filesystem::path& path,
+           const Consumer& consume,
+           const ParseOptions& options = ParseOptions());
+
+// Parses the given text as a new version of the file at the given path,
+// reusing the nodes of every line that also appears in `previous`, so only
+// the lines that changed are scanned and parsed again. `previous` may be
+// null, or a Module from parse(), in which case we parse every line. The
+// returned Module can be passed to the next call to reparse(), and it is
+// identical to the result of parsing the text from scratch, except that its
+// locations refer to a file registered with the text, so diagnostics show
+// this version rather than the file on disk. Successive versions share
+// that file, whose text each call replaces.
+shared_ptr<Module> reparse(shared_ptr<Error> error,
+                           const filesystem::path& path, const string& text,
+                           shared_ptr<const Module> previous);
+
+// Checks the syntax of the file at the given path without building a
+// Module, reporting the same diagnostics as parse(). Returns false if there
+// were errors.
+bool recognize(shared_ptr<Error> error, const filesystem::path& path);
 
 }
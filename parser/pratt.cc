@@ -0,0 +1,167 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pratt.h"
+
+#include "grammar.h"
+#ifdef SIMD_SCANNER
+#include "simd_scanner.h"
+#else
+#include "scanner.h"
+#endif
+
+namespace compiler::parser {
+
+namespace {
+
+// The precedence of each binary operator token, matching the %left levels
+// in grammar.y, or zero for other tokens
+int precedence(int token) {
+  switch (token) {
+    case '+':
+    case '-':
+      return 1;
+    case '*':
+    case '/':
+    case '%':
+      return 2;
+    case '&':
+    case '|':
+    case '^':
+    case Grammar::token::OperatorShiftLeft:
+    case Grammar::token::OperatorShiftRight:
+      return 3;
+    default:
+      return 0;
+  }
+}
+
+NodeTable::Opcode opcode(int token) {
+  switch (token) {
+    case '+':
+      return NodeTable::ADD;
+    case '-':
+      return NodeTable::SUBTRACT;
+    case '*':
+      return NodeTable::MULTIPLY;
+    case '/':
+      return NodeTable::DIVIDE;
+    case '%':
+      return NodeTable::MOD;
+    case '&':
+      return NodeTable::BIT_AND;
+    case '|':
+      return NodeTable::BIT_OR;
+    case '^':
+      return NodeTable::BIT_XOR;
+    case Grammar::token::OperatorShiftLeft:
+      return NodeTable::SHIFT_LEFT;
+    default:
+      return NodeTable::SHIFT_RIGHT;
+  }
+}
+
+}
+
+PrattParser::PrattParser(void* scanner)
+    : scanner_(scanner), state_(yyget_extra(scanner)), token_(0) {
+}
+
+void PrattParser::next() {
+  YYSTYPE value;
+  token_ = yylex(&value, &location_, scanner_);
+  if (token_ == Grammar::token::IntegerLiteral) {
+    operands_.push_back(Operand{value.as<NodeTable::Index>(), location_});
+    value.destroy<NodeTable::Index>();
+  }
+}
+
+// Replaces each operator on top of the stack that binds at least as tightly
+// as the given precedence, along with its two operands, with a binary node.
+// All of our operators are left associative, so we reduce operators of equal
+// precedence, and we stop at an open parenthesis.
+void PrattParser::reduce(int minimum) {
+  auto& nodes = state_->module->nodes;
+  while (!operators_.empty() && operators_.back().token != '(' &&
+         precedence(operators_.back().token) >= minimum) {
+    auto rhs = operands_.back();
+    operands_.pop_back();
+    auto& lhs = operands_.back();
+    lhs.location = Location::span(lhs.location, rhs.location);
+    lhs.node = nodes.add_binary(lhs.location, lhs.node,
+                                opcode(operators_.back().token), rhs.node);
+    operators_.pop_back();
+  }
+}
+
+// Parses an expression followed by a newline, starting at the current token,
+// and leaves it on top of the operand stack. Returns false at the first
+// token that cannot continue the expression.
+bool PrattParser::parse_expression() {
+  while (true) {
+    while (token_ == '(') {
+      operators_.push_back(Operator{token_, location_});
+      next();
+    }
+    if (token_ != Grammar::token::IntegerLiteral) {
+      return false;
+    }
+    next();
+    while (token_ == ')') {
+      reduce(1);
+      if (operators_.empty()) {
+        return false;
+      }
+      auto& operand = operands_.back();
+      operand.location = Location::span(operators_.back().location, location_);
+      state_->module->nodes.set_location(operand.node, operand.location);
+      operators_.pop_back();
+      next();
+    }
+    if (token_ == '\n') {
+      reduce(1);
+      return operators_.empty();
+    } else if (precedence(token_) == 0) {
+      return false;
+    }
+    reduce(precedence(token_));
+    operators_.push_back(Operator{token_, location_});
+    next();
+  }
+}
+
+int PrattParser::parse() {
+  auto& module = *state_->module;
+  while (true) {
+    next();
+    if (token_ == 0) {
+      return 0;
+    } else if (token_ == '\n') {
+      continue;
+    } else if (!parse_expression()) {
+      state_->error->report(Error::ERROR, location_, "syntax error");
+      return 1;
+    }
+    auto expression = operands_.back().node;
+    operands_.pop_back();
+    if (state_->consume) {
+      (*state_->consume)(module.nodes, expression, state_->source.ready());
+      module.nodes.clear();
+    } else {
+      module.expressions.push_back(expression);
+    }
+  }
+}
+
+}
@@ -0,0 +1,68 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../core/location.h"
+#include "table.h"
+
+namespace compiler::parser {
+
+struct State;
+
+// A hand-written alternative to the Bison parser generated from grammar.y.
+// It parses the same grammar with the same precedence levels, and records
+// the same nodes in the same order, by precedence climbing over explicit
+// operand and operator stacks. Nesting depth is limited only by memory, and
+// semantic values are plain indices that never pass through a variant.
+class PrattParser {
+ public:
+  // Parses the tokens from the given reentrant scanner, whose extra data is
+  // the State to record the program in.
+  PrattParser(void* scanner);
+
+  // Parses the entire input, returning 0 on success and 1 on a syntax
+  // error, like Grammar::parse().
+  int parse();
+
+ private:
+  struct Operand {
+    NodeTable::Index node;
+    Location location;
+  };
+
+  // A binary operator, or an open parenthesis
+  struct Operator {
+    int token;
+    Location location;
+  };
+
+  void next();
+  void reduce(int precedence);
+  bool parse_expression();
+
+  void* scanner_;
+  State* state_;
+
+  // The current token and its location. Like the lookahead location in
+  // Bison, the location carries over to the end of input, which the scanner
+  // does not give a location.
+  int token_;
+  Location location_;
+
+  vector<Operand> operands_;
+  vector<Operator> operators_;
+};
+
+}
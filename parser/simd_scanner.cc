@@ -0,0 +1,370 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "simd_scanner.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <utf8.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_SIMD 1
+#endif
+
+using namespace compiler;
+using namespace compiler::parser;
+
+namespace {
+
+// How the first byte of a token determines the scanner rule that matches it.
+enum ByteClass : uint8_t {
+  OTHER,
+  WHITESPACE,
+  NEWLINE,
+  COMMENT,
+  DIGIT,
+  SIGN,
+  LESS,
+  GREATER,
+  HIGH,
+};
+
+struct ByteClasses {
+  constexpr ByteClasses() : table() {
+    for (int c = 0x80; c <= 0xff; c++) {
+      table[c] = HIGH;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+      table[c] = DIGIT;
+    }
+    table[' '] = table['\t'] = table['\v'] = table['\f'] = table['\r'] =
+        WHITESPACE;
+    table['\n'] = NEWLINE;
+    table['#'] = COMMENT;
+    table['-'] = table['+'] = SIGN;
+    table['<'] = LESS;
+    table['>'] = GREATER;
+  }
+
+  ByteClass table[256];
+};
+
+constexpr ByteClasses byte_classes;
+
+#if defined(__AVX2__)
+
+// Each bit in a Mask corresponds to one byte of a `stride` byte block.
+using Mask = uint32_t;
+static const size_t stride = 32;
+static const Mask full_mask = 0xffffffff;
+
+inline __m256i load(const char* p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+inline Mask equal(__m256i block, char c) {
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)));
+}
+
+inline Mask high_bits(__m256i block) {
+  return _mm256_movemask_epi8(block);
+}
+
+inline Mask digits(__m256i block) {
+  // Signed comparisons are safe because bytes with the high bit set compare
+  // as negative and are never digits.
+  return _mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpgt_epi8(block, _mm256_set1_epi8('0' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), block)));
+}
+
+#elif defined(__SSE2__)
+
+using Mask = uint32_t;
+static const size_t stride = 16;
+static const Mask full_mask = 0xffff;
+
+inline __m128i load(const char* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+inline Mask equal(__m128i block, char c) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+}
+
+inline Mask high_bits(__m128i block) {
+  return _mm_movemask_epi8(block);
+}
+
+inline Mask digits(__m128i block) {
+  return _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('0' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), block)));
+}
+
+#endif
+
+inline bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Returns the end of the run of inline whitespace starting at `p`.
+const char* skip_whitespace(const char* p, const char* limit) {
+#ifdef HAVE_SIMD
+  while (p + stride <= limit) {
+    auto block = load(p);
+    auto whitespace = equal(block, ' ') | equal(block, '\t') |
+                      equal(block, '\v') | equal(block, '\f') |
+                      equal(block, '\r');
+    if (whitespace != full_mask) {
+      return p + __builtin_ctz(~whitespace);
+    }
+    p += stride;
+  }
+#endif
+  while (p < limit && byte_classes.table[static_cast<uint8_t>(*p)] ==
+                          WHITESPACE) {
+    p++;
+  }
+  return p;
+}
+
+// Returns the end of the comment starting at `p`, which is the next newline.
+// We set `high` if the comment contains any non-ASCII bytes.
+const char* skip_comment(const char* p, const char* limit, bool& high) {
+#ifdef HAVE_SIMD
+  while (p + stride <= limit) {
+    auto block = load(p);
+    auto newlines = equal(block, '\n');
+    if (newlines) {
+      auto length = __builtin_ctz(newlines);
+      high |= (high_bits(block) & ((Mask(1) << length) - 1)) != 0;
+      return p + length;
+    }
+    high |= high_bits(block) != 0;
+    p += stride;
+  }
+#endif
+  while (p < limit && *p != '\n') {
+    high |= (*p & 0x80) != 0;
+    p++;
+  }
+  return p;
+}
+
+// Returns the end of the run of decimal digits starting at `p`.
+const char* skip_digits(const char* p, const char* limit) {
+#ifdef HAVE_SIMD
+  while (p + stride <= limit) {
+    auto mask = digits(load(p));
+    if (mask != full_mask) {
+      return p + __builtin_ctz(~mask);
+    }
+    p += stride;
+  }
+#endif
+  while (p < limit && is_digit(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// Parses a decimal integer literal with an optional sign. Like strtol, which
+// the flex scanner uses, we saturate at the limits of int64_t on overflow.
+int64_t parse_integer(const char* p, const char* end) {
+  bool negative = *p == '-';
+  if (*p == '-' || *p == '+') {
+    p++;
+  }
+  uint64_t limit = negative ? uint64_t(INT64_MAX) + 1 : INT64_MAX;
+  uint64_t value = 0;
+  for (; p < end; p++) {
+    uint64_t digit = *p - '0';
+    if (value > (limit - digit) / 10) {
+      value = limit;
+      break;
+    }
+    value = value * 10 + digit;
+  }
+  return negative ? int64_t(0 - value) : int64_t(value);
+}
+
+class Scanner {
+ public:
+  Scanner(State* state) : state(state) {
+    // Mapped sources are scanned in place. Streaming sources are read into
+    // buffer_ a line at a time by refill().
+    auto& source = state->source;
+    if (source.is_mapped()) {
+      cursor_ = source.data();
+      limit_ = end_ = source.data() + source.size();
+      eof_ = true;
+    }
+  }
+
+  int lex(YYSTYPE* value, YYLTYPE* location);
+
+  State* state;
+
+ private:
+  bool refill();
+
+  // Tokens never span lines, and [cursor_, limit_) always ends with a newline
+  // or the end of the input, so no token crosses limit_. Bytes between
+  // limit_ and end_ are the start of a line we have not finished reading.
+  const char* cursor_ = nullptr;
+  const char* limit_ = nullptr;
+  const char* end_ = nullptr;
+  vector<char> buffer_;
+  bool eof_ = false;
+};
+
+// Reads from a streaming source until at least one more complete line is
+// available, returning false at the end of the input.
+bool Scanner::refill() {
+  static const size_t chunk_size = 64 * 1024;
+
+  if (eof_) {
+    return false;
+  }
+  size_t size = end_ - limit_;
+  if (size > 0) {
+    memmove(buffer_.data(), limit_, size);
+  }
+  size_t line_end = 0;
+  while (!eof_ && line_end == 0) {
+    if (buffer_.size() < size + chunk_size) {
+      buffer_.resize(std::max(buffer_.size() * 2, size + chunk_size));
+    }
+    auto count =
+        state->source.read(buffer_.data() + size, buffer_.size() - size);
+    if (count == 0) {
+      eof_ = true;
+    }
+    for (auto i = size + count; i > size; i--) {
+      if (buffer_[i - 1] == '\n') {
+        line_end = i;
+        break;
+      }
+    }
+    size += count;
+  }
+  cursor_ = buffer_.data();
+  limit_ = buffer_.data() + (eof_ ? size : line_end);
+  end_ = buffer_.data() + size;
+  return cursor_ < limit_;
+}
+
+int Scanner::lex(YYSTYPE* value, YYLTYPE* location) {
+  while (true) {
+    if (cursor_ == limit_ && !refill()) {
+      return 0;
+    }
+
+    // Find the end of the token with the same longest-match rules as flex
+    auto start = cursor_;
+    auto byte_class = byte_classes.table[static_cast<uint8_t>(*start)];
+    bool high = false;
+    switch (byte_class) {
+      case WHITESPACE:
+        cursor_ = skip_whitespace(start + 1, limit_);
+        break;
+      case COMMENT:
+        cursor_ = skip_comment(start + 1, limit_, high);
+        break;
+      case DIGIT:
+        cursor_ = skip_digits(start + 1, limit_);
+        break;
+      case SIGN:
+        if (start + 1 < limit_ && is_digit(start[1])) {
+          cursor_ = skip_digits(start + 2, limit_);
+        } else {
+          byte_class = OTHER;
+          cursor_ = start + 1;
+        }
+        break;
+      case LESS:
+      case GREATER:
+        if (start + 1 < limit_ && start[1] == *start) {
+          cursor_ = start + 2;
+        } else {
+          byte_class = OTHER;
+          cursor_ = start + 1;
+        }
+        break;
+      case HIGH:
+        throw utf8::invalid_utf8(*start);
+      default:
+        cursor_ = start + 1;
+        break;
+    }
+
+    // Non-ASCII characters are only allowed in comments, and we only
+    // validate UTF-8 when a comment contains a byte with the high bit set.
+    if (high) {
+      auto invalid = utf8::find_invalid(start, cursor_);
+      if (invalid != cursor_) {
+        throw utf8::invalid_utf8(*invalid);
+      }
+    }
+    location->begin = state->offset;
+    location->length = cursor_ - start;
+    location->file = state->file;
+    state->offset += cursor_ - start;
+
+    switch (byte_class) {
+      case WHITESPACE:
+      case COMMENT:
+        continue;
+      case NEWLINE:
+        return '\n';
+      case DIGIT:
+      case SIGN:
+        if (state->module) {
+          value->emplace<NodeTable::Index>(
+              state->module->nodes.add_integer_literal(
+                  *location, parse_integer(start, cursor_)));
+        }
+        return Grammar::token::IntegerLiteral;
+      case LESS:
+        return Grammar::token::OperatorShiftLeft;
+      case GREATER:
+        return Grammar::token::OperatorShiftRight;
+      default:
+        return *start;
+    }
+  }
+}
+
+}
+
+int yylex_init_extra(YY_EXTRA_TYPE extra, yyscan_t* scanner) {
+  *scanner = new Scanner(extra);
+  return 0;
+}
+
+int yylex_destroy(yyscan_t scanner) {
+  delete static_cast<Scanner*>(scanner);
+  return 0;
+}
+
+YY_EXTRA_TYPE yyget_extra(yyscan_t scanner) {
+  return static_cast<Scanner*>(scanner)->state;
+}
+
+int yylex(YYSTYPE* value, YYLTYPE* location, yyscan_t scanner) {
+  return static_cast<Scanner*>(scanner)->lex(value, location);
+}
@@ -0,0 +1,28 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "grammar.h"
+
+// A hand-written replacement for the flex scanner in scanner.l, selected with
+// the SIMD_SCANNER build option. It exposes the same reentrant interface as
+// the flex-generated scanner.h and produces an identical stream of tokens and
+// locations.
+typedef void* yyscan_t;
+
+int yylex_init_extra(YY_EXTRA_TYPE extra, yyscan_t* scanner);
+int yylex_destroy(yyscan_t scanner);
+YY_EXTRA_TYPE yyget_extra(yyscan_t scanner);
+int yylex(YYSTYPE* value, YYLTYPE* location, yyscan_t scanner);
@@ -0,0 +1,159 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "table.h"
+
+#include <assert.h>
+#include <limits>
+#include <stdexcept>
+
+namespace compiler::parser {
+
+void NodeTable::enable_sharing() {
+  sharing_ = true;
+}
+
+NodeTable::Index NodeTable::add_integer_literal(const Location& location,
+                                                int64_t value) {
+  Index node;
+  Key key{uint64_t(INTEGER_LITERAL) << 32, uint64_t(value)};
+  if (sharing_ && find_shared(key, location, node)) {
+    return node;
+  }
+  node = add(location, INTEGER_LITERAL, values.size(), 0);
+  values.push_back(value);
+  return node;
+}
+
+NodeTable::Index NodeTable::add_binary(const Location& location, Index lhs,
+                                       Opcode op, Index rhs) {
+  Index node;
+  Key key{uint64_t(op) << 32 | lhs, rhs};
+  if (sharing_ && find_shared(key, location, node)) {
+    return node;
+  }
+  return add(location, op, lhs, rhs);
+}
+
+void NodeTable::set_location(Index node, const Location& location) {
+  if (last_occurrence_ != NONE) {
+    occurrences[last_occurrence_].location = location;
+  } else {
+    locations[node] = location;
+  }
+}
+
+NodeTable::Index NodeTable::append(const NodeTable& other, Index begin,
+                                   Index end, int64_t shift, FileID file) {
+  if (size() + (end - begin) > std::numeric_limits<Index>::max()) {
+    throw std::length_error("too many expressions");
+  }
+  Index base = size();
+  opcodes.insert(opcodes.end(), other.opcodes.begin() + begin,
+                 other.opcodes.begin() + end);
+  lhs.resize(size());
+  rhs.resize(size());
+  locations.resize(size());
+  for (Index i = begin; i < end; i++) {
+    auto node = base + (i - begin);
+    if (other.is_binary(i)) {
+      lhs[node] = other.lhs[i] - begin + base;
+      rhs[node] = other.rhs[i] - begin + base;
+    } else {
+      lhs[node] = values.size();
+      rhs[node] = other.rhs[i];
+      values.push_back(other.value(i));
+    }
+    locations[node] = other.locations[i];
+    locations[node].begin += shift;
+    locations[node].file = file;
+  }
+  for (auto& occurrence : other.occurrences) {
+    if (occurrence.node >= begin && occurrence.node < end) {
+      occurrences.push_back(occurrence);
+      occurrences.back().node += base - begin;
+      occurrences.back().location.begin += shift;
+      occurrences.back().location.file = file;
+    }
+  }
+  last_occurrence_ = NONE;
+  return base;
+}
+
+void NodeTable::append_shared(const NodeTable& other, vector<Index>& nodes) {
+  assert(sharing_);
+  nodes.resize(other.size());
+  for (Index i = 0; i < other.size(); i++) {
+    if (other.is_binary(i)) {
+      nodes[i] = add_binary(other.locations[i], nodes[other.lhs[i]],
+                            other.opcodes[i], nodes[other.rhs[i]]);
+    } else {
+      nodes[i] = add_integer_literal(other.locations[i], other.value(i));
+    }
+  }
+  for (auto& occurrence : other.occurrences) {
+    occurrences.push_back(
+        Occurrence{nodes[occurrence.node], occurrence.location});
+  }
+  last_occurrence_ = NONE;
+}
+
+void NodeTable::reserve(size_t nodes, size_t values) {
+  opcodes.reserve(nodes);
+  lhs.reserve(nodes);
+  rhs.reserve(nodes);
+  locations.reserve(nodes);
+  this->values.reserve(values);
+}
+
+void NodeTable::clear() {
+  opcodes.clear();
+  lhs.clear();
+  rhs.clear();
+  values.clear();
+  locations.clear();
+  occurrences.clear();
+  shared_.clear();
+  last_occurrence_ = NONE;
+}
+
+NodeTable::Index NodeTable::add(const Location& location, Opcode op,
+                                Index lhs, Index rhs) {
+  if (opcodes.size() >= std::numeric_limits<Index>::max()) {
+    throw std::length_error("too many expressions");
+  }
+  opcodes.push_back(op);
+  this->lhs.push_back(lhs);
+  this->rhs.push_back(rhs);
+  locations.push_back(location);
+  last_occurrence_ = NONE;
+  return opcodes.size() - 1;
+}
+
+// Returns true and sets `node` if the table has a node with the given key,
+// recording this use of it. Otherwise, we reserve the key for the node the
+// caller is about to add.
+bool NodeTable::find_shared(const Key& key, const Location& location,
+                            Index& node) {
+  auto [match, inserted] = shared_.try_emplace(key, size());
+  if (inserted) {
+    return false;
+  }
+  node = match->second;
+  occurrences.push_back(Occurrence{node, location});
+  last_occurrence_ = occurrences.size() - 1;
+  return true;
+}
+
+}
@@ -0,0 +1,171 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+
+#include "../core/common.h"
+#include "../core/location.h"
+
+namespace compiler::parser {
+
+// A compact, flattened representation of the expressions in a module. Each
+// node is a row across a set of parallel arrays, and nodes refer to their
+// children by 32-bit index rather than by pointer.
+//
+// The grammar appends nodes as it reduces them, so the children of every node
+// precede it in the table, and the nodes of each subtree are contiguous. A
+// forward scan over a subtree is therefore a post-order traversal.
+//
+// If sharing is enabled, structurally identical subexpressions are recorded
+// once, and the table becomes a DAG. Children still precede their parents,
+// but subtrees are no longer contiguous.
+class NodeTable {
+ public:
+  using Index = uint32_t;
+
+  enum Opcode : uint8_t {
+    ADD,
+    SUBTRACT,
+    DIVIDE,
+    MULTIPLY,
+    MOD,
+    SHIFT_LEFT,
+    SHIFT_RIGHT,
+    BIT_AND,
+    BIT_OR,
+    BIT_XOR,
+    INTEGER_LITERAL,
+  };
+
+  // A use of a shared node other than the first, whose location is in
+  // `locations`.
+  struct Occurrence {
+    Index node;
+    Location location;
+  };
+
+  // Records structurally identical subexpressions added from now on in a
+  // single node, and the location of every further use in `occurrences`.
+  void enable_sharing();
+
+  inline bool is_sharing() const {
+    return sharing_;
+  }
+
+  // Appends a 64-bit integer constant, returning its index.
+  Index add_integer_literal(const Location& location, int64_t value);
+
+  // Appends a binary operation on two existing nodes, returning its index.
+  Index add_binary(const Location& location, Index lhs, Opcode op, Index rhs);
+
+  // Sets the location of the most recent use of the given node, which must
+  // be the last node added, e.g., to include the parentheses around it.
+  void set_location(Index node, const Location& location);
+
+  // Appends the nodes in [begin, end) of `other`, which must only refer to
+  // nodes in that range, e.g., a run of whole top-level expressions. Their
+  // locations are moved `shift` bytes into `file`. Returns the index of the
+  // first appended node.
+  Index append(const NodeTable& other, Index begin, Index end, int64_t shift,
+               FileID file);
+
+  // Appends every node of `other`, recording nodes identical to ones already
+  // in this table once, just as if they had been added here, and sets
+  // `nodes[i]` to the index of node `i` of `other` in this table. Only valid
+  // if sharing is enabled.
+  void append_shared(const NodeTable& other, vector<Index>& nodes);
+
+  // Allocates space for the given number of nodes and literal values.
+  void reserve(size_t nodes, size_t values);
+
+  // Removes all nodes from the table, keeping the allocated capacity.
+  void clear();
+
+  // The number of nodes in the table.
+  inline size_t size() const {
+    return opcodes.size();
+  }
+
+  inline bool is_binary(Index node) const {
+    return opcodes[node] != INTEGER_LITERAL;
+  }
+
+  // The value of the integer literal at the given index.
+  inline int64_t value(Index node) const {
+    return values[lhs[node]];
+  }
+
+  // Returns the index of the first node in the subtree rooted at `root`,
+  // which is its leftmost leaf. Only valid if sharing is disabled.
+  inline Index first(Index root) const {
+    while (is_binary(root)) {
+      root = lhs[root];
+    }
+    return root;
+  }
+
+  // Calls `visit(index)` for every node in the subtree rooted at `root`,
+  // visiting children before their parents. Only valid if sharing is
+  // disabled.
+  template <typename Visitor>
+  void visit_postorder(Index root, Visitor&& visit) const {
+    for (auto i = first(root); i <= root; i++) {
+      visit(i);
+    }
+  }
+
+  vector<Opcode> opcodes;
+
+  // The operands of binary nodes. For integer literals, `lhs` is the index
+  // of the literal in `values` instead.
+  vector<Index> lhs;
+  vector<Index> rhs;
+
+  vector<int64_t> values;
+  vector<Location> locations;
+  vector<Occurrence> occurrences;
+
+ private:
+  // Identifies a node by its opcode and operands, or its value for literals
+  struct Key {
+    uint64_t head;
+    uint64_t tail;
+
+    inline bool operator==(const Key& other) const {
+      return head == other.head && tail == other.tail;
+    }
+  };
+
+  struct KeyHash {
+    inline size_t operator()(const Key& key) const {
+      return key.head * 0x9e3779b97f4a7c15 ^ key.tail;
+    }
+  };
+
+  Index add(const Location& location, Opcode op, Index lhs, Index rhs);
+  bool find_shared(const Key& key, const Location& location, Index& node);
+
+  static const size_t NONE = SIZE_MAX;
+
+  bool sharing_ = false;
+  std::unordered_map<Key, Index, KeyHash> shared_;
+
+  // The index in `occurrences` of the last node added if it was shared
+  size_t last_occurrence_ = NONE;
+};
+
+}
@@ -0,0 +1,83 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "output.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace compiler::runtime {
+
+// The decimal digits of 0 to 99, so we can format two digits per division.
+// emitter/runtime.cc emits the same table and algorithm for our programs.
+static const char digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static char buffer[64 * 1024];
+static size_t buffer_size = 0;
+
+size_t format(int64_t value, char* line) {
+  // Format the digits right to left. The last pair is written even if the
+  // value has a single digit left, and its leading zero is skipped.
+  char digits[max_line - 1];
+  auto end = digits + sizeof(digits);
+  auto position = end;
+  uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+  while (magnitude >= 100) {
+    auto pair = magnitude % 100;
+    magnitude /= 100;
+    position -= 2;
+    memcpy(position, digit_pairs + 2 * pair, 2);
+  }
+  position -= 2;
+  memcpy(position, digit_pairs + 2 * magnitude, 2);
+  position += magnitude < 10;
+  if (value < 0) {
+    *--position = '-';
+  }
+
+  size_t length = end - position;
+  memcpy(line, position, length);
+  line[length] = '\n';
+  return length + 1;
+}
+
+void print(int64_t value) {
+  if (buffer_size > sizeof(buffer) - max_line) {
+    flush();
+  }
+  buffer_size += format(value, buffer + buffer_size);
+}
+
+void flush() {
+  size_t written = 0;
+  while (written < buffer_size) {
+    auto result =
+        write(STDOUT_FILENO, buffer + written, buffer_size - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    } else if (result <= 0) {
+      break;
+    }
+    written += result;
+  }
+  buffer_size = 0;
+}
+
+}
@@ -0,0 +1,38 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../core/common.h"
+
+namespace compiler::runtime {
+
+// The longest line we print, which is a sign, 19 digits, and a newline
+inline constexpr size_t max_line = 21;
+
+// Writes the line that print() prints for the given value to `line`, which
+// must have room for `max_line` characters. We return the length of the
+// line.
+size_t format(int64_t value, char* line);
+
+// Prints the given value and a newline to stdout, exactly as the print
+// function in the runtime of the programs we emit does. Output is buffered
+// until the buffer fills or flush() is called, so it is not thread safe, and
+// it is not ordered with output written to stdout in other ways.
+void print(int64_t value);
+
+// Writes the buffered output to stdout.
+void flush();
+
+}
@@ -0,0 +1,151 @@
+# Copyright 2020 Bret Taylor
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Runs edge-case programs on every engine of `compiler run` and expects the
+# same output and exit status from each of them.
+#
+# Usage: engines_test.sh path/to/compiler
+
+compiler=$1
+directory=$(mktemp -d)
+trap 'rm -rf "$directory"' EXIT
+failures=0
+
+# Runs $directory/$1.txt with each set of arguments that follows and
+# compares the results with those of the first set.
+compare() {
+  name=$1
+  program=$directory/$name.txt
+  shift
+  # shellcheck disable=SC2086
+  "$compiler" run $1 "$program" > "$directory/expected" 2>&1
+  expected_status=$?
+  reference=$1
+  shift
+  for arguments in "$@"; do
+    # shellcheck disable=SC2086
+    "$compiler" run $arguments "$program" > "$directory/actual" 2>&1
+    status=$?
+    if [ "$status" != "$expected_status" ] ||
+        ! cmp -s "$directory/expected" "$directory/actual"; then
+      echo "FAIL $name: run $arguments differs from run $reference"
+      diff "$directory/expected" "$directory/actual" | head -n 10
+      failures=$((failures + 1))
+    fi
+  done
+}
+
+# Runs $directory/$1.txt on each engine and compares the results with those
+# of the checker. Streaming prints values before an error, so we compare it
+# with streaming in the checker.
+check() {
+  before=$failures
+  compare "$1" "-engine=fold" "-engine=vm" "-engine=jit" "-engine=tiered" \
+    "-engine=tiered -tier-chunk=7"
+  compare "$1" "-stream -engine=fold" "-stream -engine=vm" \
+    "-stream -engine=jit"
+  if [ "$failures" = "$before" ]; then
+    echo "PASS $1"
+  fi
+}
+
+# Checks that $directory/$1.txt also prints exactly the lines that follow.
+expect() {
+  name=$1
+  shift
+  printf '%s\n' "$@" > "$directory/wanted"
+  "$compiler" run -engine=fold "$directory/$name.txt" > "$directory/actual"
+  if ! cmp -s "$directory/wanted" "$directory/actual"; then
+    echo "FAIL $name: unexpected output"
+    diff "$directory/wanted" "$directory/actual" | head -n 10
+    failures=$((failures + 1))
+  fi
+}
+
+# Arithmetic wraps around in two's complement.
+cat > "$directory/wraparound.txt" <<'PROGRAM'
+9223372036854775807 + 1
+-9223372036854775808 - 1
+-9223372036854775807 - 2
+3037000500 * 3037000500
+4611686018427387904 * 4
+-9223372036854775808 * -1
+PROGRAM
+check wraparound
+expect wraparound -9223372036854775808 9223372036854775807 \
+  9223372036854775807 -9223372036709301616 0 -9223372036854775808
+
+# Division truncates towards zero.
+cat > "$directory/division.txt" <<'PROGRAM'
+-9223372036854775808
+-9223372036854775808 / 1
+-9223372036854775808 % 3
+-7 / 2
+-7 % 2
+7 / -2
+7 % -2
+PROGRAM
+check division
+expect division -9223372036854775808 -9223372036854775808 -2 -3 -1 -3 1
+
+# Right shifts are logical.
+cat > "$directory/shifts.txt" <<'PROGRAM'
+1 << 63
+3 << 62
+1 << 0
+-1 >> 1
+-8 >> 63
+-9223372036854775808 >> 63
+-1 ^ 5
+-1 & 5
+6 | 9
+PROGRAM
+check shifts
+expect shifts -9223372036854775808 -4611686018427387904 1 \
+  9223372036854775807 1 1 -6 5 15
+
+# Undefined operations fail with the same error everywhere.
+for program in "1 / 0" "1 % 0" "-9223372036854775808 / -1" \
+    "-9223372036854775808 % -1" "1 << 64" "1 >> -1"; do
+  printf '1\n%s\n2\n' "$program" > "$directory/undefined.txt"
+  check undefined
+done
+
+# Deep nesting on either side, and long flat chains.
+awk 'BEGIN {
+  n = 100000
+  for (i = 0; i < n; i++) printf "("
+  printf "1"
+  for (i = 0; i < n; i++) printf ")"
+  printf "\n1"
+  for (i = 0; i < n; i++) printf " - 1"
+  printf "\n"
+  for (i = 0; i < 10000; i++) printf "%d - (", i
+  printf "1"
+  for (i = 0; i < 10000; i++) printf ")"
+  printf "\n"
+}' > "$directory/nesting.txt"
+check nesting
+
+# More expressions than fit in one function, batch or tier chunk.
+awk 'BEGIN {
+  for (i = 0; i < 20000; i++)
+    printf "%d * %d + (%d << %d) - %d\n", i, i - 7, i, i % 64, i % 13
+}' > "$directory/long.txt"
+check long
+
+if [ "$failures" != 0 ]; then
+  echo "$failures failures"
+  exit 1
+fi
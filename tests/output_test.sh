@@ -0,0 +1,99 @@
+# Copyright 2020 Bret Taylor
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Builds programs that print edge-case values and expects the binaries, and
+# the IR run with lli when it is available, to print exactly what
+# `compiler run` does.
+#
+# Usage: output_test.sh path/to/compiler
+
+compiler=$1
+directory=$(mktemp -d)
+trap 'rm -rf "$directory"' EXIT
+failures=0
+
+# Compares the output of `compiler $1 ... $directory/$2.txt` run through
+# $3, or the binary it builds, with the output of `compiler run`.
+compare() {
+  command=$1
+  name=$2
+  program=$directory/$name.txt
+  "$compiler" run "$program" > "$directory/expected" || exit 1
+  case "$command" in
+    build*)
+      # shellcheck disable=SC2086
+      "$compiler" $command -output="$directory/$name" "$program" &&
+        "$directory/$name" > "$directory/actual"
+      ;;
+    ir*)
+      # shellcheck disable=SC2086
+      "$compiler" $command "$program" | "$lli" > "$directory/actual"
+      ;;
+  esac
+  if ! cmp -s "$directory/expected" "$directory/actual"; then
+    echo "FAIL $name: $command differs from run"
+    diff "$directory/expected" "$directory/actual" | head -n 10
+    failures=$((failures + 1))
+  fi
+}
+
+# Builds $directory/$1.txt in each way we can emit a program.
+check() {
+  before=$failures
+  for command in "build" "build -O=0" "build -stream" "build -image"; do
+    compare "$command" "$1"
+  done
+  if [ -n "$lli" ]; then
+    compare "ir" "$1"
+    compare "ir -stream" "$1"
+  fi
+  if [ "$failures" = "$before" ]; then
+    echo "PASS $1"
+  fi
+}
+
+lli=$(command -v lli || ls /usr/bin/lli-* 2> /dev/null | tail -n 1)
+
+# Values around each change in the number of digits, and the extremes.
+cat > "$directory/values.txt" <<'PROGRAM'
+0
+9
+10
+99
+100
+-1
+-9
+-10
+-99
+-100
+1000000000
+9223372036854775807
+-9223372036854775808
+PROGRAM
+check values
+
+# Enough output of every length to cross the 64 KiB output buffer many
+# times, at a different offset each time.
+awk 'BEGIN {
+  for (i = 0; i < 6000; i++) {
+    print "-9223372036854775808"
+    printf "%d\n%d\n", i, -i * 1000003
+  }
+}' > "$directory/buffer.txt"
+check buffer
+
+if [ "$failures" != 0 ]; then
+  echo "$failures failures"
+  exit 1
+fi
@@ -0,0 +1,338 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+
+#include "../core/source.h"
+#include "../parser/parse.h"
+#include "test.h"
+
+namespace compiler::parser {
+
+namespace {
+
+// Records diagnostics so tests can inspect them.
+class Recorder : public Error {
+ public:
+  struct Diagnostic {
+    bool has_location;
+    Location location;
+    string message;
+  };
+
+  vector<Diagnostic> diagnostics;
+
+ protected:
+  void display(Level level, Location location,
+               const string& message) override {
+    diagnostics.push_back(Diagnostic{true, location, message});
+  }
+
+  void display(Level level, const string& message) override {
+    diagnostics.push_back(Diagnostic{false, Location(), message});
+  }
+};
+
+// Writes the given text to a file and parses it from scratch.
+shared_ptr<Module> parse_text(const string& text,
+                              const ParseOptions& options = ParseOptions()) {
+  test::TemporaryFile file(text);
+  return parse(make_shared<Recorder>(), file.path, options);
+}
+
+string join(const vector<string>& lines) {
+  string text;
+  for (auto& line : lines) {
+    text += line + "\n";
+  }
+  return text;
+}
+
+// Returns true if node `i` of `a` and node `j` of `b` have the same opcode,
+// operands or value, and location within their files.
+bool same_node(const NodeTable& a, NodeTable::Index i, const NodeTable& b,
+               NodeTable::Index j) {
+  if (a.opcodes[i] != b.opcodes[j] ||
+      a.locations[i].begin != b.locations[j].begin ||
+      a.locations[i].length != b.locations[j].length) {
+    return false;
+  }
+  if (!a.is_binary(i)) {
+    return a.value(i) == b.value(j);
+  }
+  return a.lhs[i] == b.lhs[j] && a.rhs[i] == b.rhs[j];
+}
+
+// Expects two Modules to have the same expressions and nodes, wherever
+// their locations refer to.
+void expect_same(const Module& expected, const Module& actual) {
+  EXPECT(expected.expressions == actual.expressions);
+  EXPECT_EQ(expected.nodes.size(), actual.nodes.size());
+  if (expected.nodes.size() != actual.nodes.size()) {
+    return;
+  }
+  for (NodeTable::Index i = 0; i < expected.nodes.size(); i++) {
+    if (!same_node(expected.nodes, i, actual.nodes, i)) {
+      test::fail(__FILE__, __LINE__,
+                 "node " + std::to_string(i) + " differs");
+      return;
+    }
+  }
+}
+
+// Returns a random expression that parses without errors.
+string random_line(std::mt19937& random) {
+  static const char* operators[] = {"+", "-", "*", "/", "%",
+                                    "&", "|", "^", "<<", ">>"};
+  switch (random() % 8) {
+    case 0:
+      return "";
+    case 1:
+      return "# comment " + std::to_string(random() % 4);
+    default:
+      break;
+  }
+  string line = std::to_string(random() % 100);
+  for (auto count = random() % 4; count > 0; count--) {
+    line += string(" ") + operators[random() % 10] + " ";
+    if (random() % 3 == 0) {
+      line += "(" + std::to_string(random() % 10) + " + 1)";
+    } else {
+      line += std::to_string(random() % 100);
+    }
+  }
+  return line;
+}
+
+// Returns a program of at least `size` bytes whose lines repeat the same
+// few subexpressions, within each line and across lines.
+string repetitive_program(size_t size) {
+  std::mt19937 random(10);
+  string text;
+  while (text.size() < size) {
+    auto a = std::to_string(random() % 16);
+    auto b = std::to_string(random() % 16);
+    text += "(" + a + " + " + b + ") * (" + a + " + " + b + ") - " + b + "\n";
+  }
+  return text;
+}
+
+// Returns the number of times `needle` appears in `text`.
+size_t count(const string& text, const string& needle) {
+  size_t count = 0;
+  for (auto i = text.find(needle); i != string::npos;
+       i = text.find(needle, i + 1)) {
+    count++;
+  }
+  return count;
+}
+
+// Parses the given text with both parsers, and expects the same Module or
+// failure and the same diagnostics from each.
+void expect_parsers_agree(const string& text) {
+  test::TemporaryFile file(text);
+  ParseOptions bison;
+  bison.pratt = false;
+  auto bison_error = make_shared<Recorder>();
+  auto bison_module = parse(bison_error, file.path, bison);
+  ParseOptions pratt;
+  pratt.pratt = true;
+  auto pratt_error = make_shared<Recorder>();
+  auto pratt_module = parse(pratt_error, file.path, pratt);
+
+  EXPECT_EQ(bison_module == nullptr, pratt_module == nullptr);
+  if (bison_module && pratt_module) {
+    expect_same(*bison_module, *pratt_module);
+  }
+  auto& expected = bison_error->diagnostics;
+  auto& actual = pratt_error->diagnostics;
+  EXPECT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < std::min(expected.size(), actual.size()); i++) {
+    EXPECT_EQ(expected[i].message, actual[i].message);
+    EXPECT_EQ(expected[i].has_location, actual[i].has_location);
+    EXPECT_EQ(expected[i].location.begin, actual[i].location.begin);
+    EXPECT_EQ(expected[i].location.length, actual[i].location.length);
+  }
+}
+
+}
+
+TEST(parsers_agree_on_valid_programs) {
+  std::mt19937 random(12);
+  for (int i = 0; i < 200; i++) {
+    vector<string> lines;
+    for (auto count = random() % 20; count > 0; count--) {
+      lines.push_back(random_line(random));
+    }
+    expect_parsers_agree(join(lines));
+  }
+  expect_parsers_agree("");
+  expect_parsers_agree("# no newline");
+  expect_parsers_agree("-5 - -5 + +5\n");
+  expect_parsers_agree("1 << 2 >> 3 & 4 | 5 ^ 6 % 7\n");
+  expect_parsers_agree("9223372036854775807 + -9223372036854775808\n");
+  expect_parsers_agree("  1\t+\v2 # sum\r\n");
+}
+
+TEST(parsers_agree_on_errors) {
+  for (auto text : {"1 +\n", "(1\n", "1)\n", ")\n", "1 2\n", "+\n",
+                    "1 + * 2\n", "((1)\n", "1 +", "1 $ 2\n", "1 < 2\n",
+                    "()\n", "1\n2 +\n3\n", "# c\n\n  (1 + (2\n", "\xff\n",
+                    "1 # \xc3\n", "<<\n", "1 <<\n"}) {
+    expect_parsers_agree(text);
+  }
+
+  // Random token sequences, most of which are invalid
+  static const char* tokens[] = {"1",  "23", "(", ")", "+", "-", "*",
+                                 "<<", ">>", " ", "\n", "# c\n", "$"};
+  std::mt19937 random(13);
+  for (int i = 0; i < 2000; i++) {
+    string text;
+    for (auto count = random() % 12; count > 0; count--) {
+      text += tokens[random() % 13];
+    }
+    expect_parsers_agree(text);
+  }
+}
+
+TEST(parsers_agree_on_deep_nesting) {
+  const size_t depth = 100000;
+  expect_parsers_agree(string(depth, '(') + "1" + string(depth, ')') + "\n");
+  expect_parsers_agree(string(depth, '(') + "1" + string(depth - 1, ')') +
+                       "\n");
+
+  string left = "1";
+  string right = "1";
+  for (size_t i = 0; i < depth; i++) {
+    left += " - 1";
+    right += i % 2 ? " + (1" : " * (1";
+  }
+  expect_parsers_agree(left + "\n");
+  expect_parsers_agree(right + string(depth, ')') + "\n");
+}
+
+TEST(chunked_parse_shares_nodes_across_chunks) {
+  // Large enough to be split into pieces parsed on separate threads
+  auto text = repetitive_program(3 * 1024 * 1024);
+  ParseOptions serial;
+  serial.share = true;
+  auto expected = parse_text(text, serial);
+
+  Timing timing(true);
+  auto chunked = serial;
+  chunked.jobs = 4;
+  chunked.timing = &timing;
+  auto actual = parse_text(text, chunked);
+  std::ostringstream trace;
+  timing.print_trace(trace);
+  EXPECT_EQ(3u, count(trace.str(), "\"parse chunk\""));
+
+  EXPECT(expected && actual);
+  if (expected && actual) {
+    EXPECT(actual->nodes.is_sharing());
+    expect_same(*expected, *actual);
+    EXPECT_EQ(expected->nodes.occurrences.size(),
+              actual->nodes.occurrences.size());
+  }
+}
+
+TEST(reparse_matches_parse_after_edits) {
+  std::mt19937 random(9);
+  vector<string> lines;
+  for (int i = 0; i < 200; i++) {
+    lines.push_back(random_line(random));
+  }
+  auto error = make_shared<Recorder>();
+  auto module = reparse(error, "edited.txt", join(lines), nullptr);
+  EXPECT(module != nullptr);
+  expect_same(*parse_text(join(lines)), *module);
+
+  for (int edit = 0; edit < 300 && module; edit++) {
+    auto line = random() % lines.size();
+    switch (edit % 5) {
+      case 0:
+        lines.insert(lines.begin() + line, random_line(random));
+        break;
+      case 1:
+        lines.erase(lines.begin() + line);
+        break;
+      case 2: {
+        // Move a line elsewhere
+        auto moved = lines[line];
+        lines.erase(lines.begin() + line);
+        lines.insert(lines.begin() + random() % lines.size(), moved);
+        break;
+      }
+      case 3:
+        // Duplicate a line
+        lines.insert(lines.begin() + random() % lines.size(), lines[line]);
+        break;
+      case 4:
+        lines[line] = random_line(random);
+        break;
+    }
+    auto text = join(lines);
+    module = reparse(error, "edited.txt", text, module);
+    EXPECT(module != nullptr);
+    if (module) {
+      expect_same(*parse_text(text), *module);
+    }
+  }
+  EXPECT(error->diagnostics.empty());
+}
+
+TEST(reparse_without_final_newline) {
+  // Only a comment can end the text without a newline
+  auto error = make_shared<Recorder>();
+  auto first = reparse(error, "edited.txt", "1 + 2\n# end\n", nullptr);
+  auto second = reparse(error, "edited.txt", "1 + 2\n# end", first);
+  EXPECT(second != nullptr);
+  expect_same(*parse_text("1 + 2\n# end"), *second);
+  auto third = reparse(error, "edited.txt", "# end\n1 + 2\n", second);
+  EXPECT(third != nullptr);
+  expect_same(*parse_text("# end\n1 + 2\n"), *third);
+  EXPECT(reparse(error, "edited.txt", "# end\n1 + 2", third) == nullptr);
+}
+
+TEST(reparse_reuses_one_file) {
+  auto error = make_shared<Recorder>();
+  auto module = reparse(error, "edited.txt", "1\n", nullptr);
+  auto file = module->file;
+  for (int i = 2; i < 100; i++) {
+    auto text = *module->text + std::to_string(i) + "\n";
+    module = reparse(error, "edited.txt", text, module);
+  }
+  EXPECT_EQ(file, module->file);
+  EXPECT_EQ(99u, module->expressions.size());
+}
+
+TEST(reparse_reports_positions_in_the_edited_text) {
+  // The file on disk has different lines than the buffer we parse
+  test::TemporaryFile file("# on disk\n1\n");
+  auto error = make_shared<Recorder>();
+  auto module = reparse(error, file.path, "1\n2\n3\n", nullptr);
+  EXPECT(module != nullptr);
+
+  module = reparse(error, file.path, "1\n2\n3 +\n", module);
+  EXPECT(module == nullptr);
+  EXPECT_EQ(1u, error->diagnostics.size());
+  if (error->diagnostics.size() == 1) {
+    auto location = error->diagnostics[0].location;
+    auto& sources = SourceManager::shared();
+    EXPECT_EQ(string("1\n2\n3 +\n"), *sources.text(location.file));
+    EXPECT_EQ(3u, sources.position(location.file, location.begin).line);
+  }
+}
+
+}
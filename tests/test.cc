@@ -0,0 +1,92 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+
+namespace compiler::test {
+
+namespace {
+
+struct Case {
+  const char* name;
+  void (*run)();
+};
+
+// Function-local, so test cases can register from static initializers in
+// any translation unit
+vector<Case>& cases() {
+  static vector<Case> cases;
+  return cases;
+}
+
+size_t failures = 0;
+
+}
+
+bool add(const char* name, void (*run)()) {
+  cases().push_back(Case{name, run});
+  return true;
+}
+
+void fail(const char* file, int line, const string& message) {
+  std::cerr << file << ":" << line << ": " << message << std::endl;
+  failures++;
+}
+
+TemporaryFile::TemporaryFile(const string& contents) {
+  auto pattern = (filesystem::temp_directory_path() / "test.XXXXXX").string();
+  auto fd = mkstemp(pattern.data());
+  if (fd == -1) {
+    std::cerr << "Could not create " << pattern << std::endl;
+    abort();
+  }
+  close(fd);
+  path = pattern;
+  std::ofstream(path, std::ios::binary) << contents;
+}
+
+TemporaryFile::~TemporaryFile() {
+  std::error_code error;
+  filesystem::remove(path, error);
+}
+
+}
+
+// Runs every test case, or only those whose names contain the argument, and
+// exits with a failure status if any of them failed.
+int main(int argc, char** argv) {
+  using namespace compiler::test;
+  size_t failed = 0;
+  for (auto& test : cases()) {
+    if (argc > 1 && !strstr(test.name, argv[1])) {
+      continue;
+    }
+    auto before = failures;
+    test.run();
+    auto passed = failures == before;
+    std::cerr << (passed ? "PASS " : "FAIL ") << test.name << std::endl;
+    failed += !passed;
+  }
+  if (failed) {
+    std::cerr << failed << " failed" << std::endl;
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <sstream>
+
+#include "../core/common.h"
+
+// A minimal test framework. TEST defines a test case, which the test runner
+// calls in the order the cases are defined. EXPECT and EXPECT_EQ record a
+// failure and continue with the rest of the case.
+
+#define TEST(name)                                                   \
+  static void name();                                                \
+  static const bool name##_added = compiler::test::add(#name, name); \
+  static void name()
+
+#define EXPECT(condition)                                   \
+  do {                                                      \
+    if (!(condition)) {                                     \
+      compiler::test::fail(__FILE__, __LINE__, #condition); \
+    }                                                       \
+  } while (0)
+
+#define EXPECT_EQ(expected, actual)                                       \
+  do {                                                                    \
+    auto&& expected_value = (expected);                                   \
+    auto&& actual_value = (actual);                                       \
+    if (!(expected_value == actual_value)) {                              \
+      compiler::test::fail(__FILE__, __LINE__,                            \
+                           #actual " is " +                               \
+                               compiler::test::describe(actual_value) +   \
+                               ", expected " +                            \
+                               compiler::test::describe(expected_value)); \
+    }                                                                     \
+  } while (0)
+
+namespace compiler::test {
+
+// Registers a test case, returning true so it can initialize a static.
+bool add(const char* name, void (*run)());
+
+// Records a failure of the running test case.
+void fail(const char* file, int line, const string& message);
+
+template <typename T>
+string describe(const T& value) {
+  std::ostringstream out;
+  out << value;
+  return out.str();
+}
+
+// A file with the given contents in the temporary directory, which is
+// removed when this is destroyed.
+class TemporaryFile {
+ public:
+  TemporaryFile(const string& contents);
+  ~TemporaryFile();
+
+  TemporaryFile(const TemporaryFile&) = delete;
+  TemporaryFile& operator=(const TemporaryFile&) = delete;
+
+  filesystem::path path;
+};
+
+}
@@ -0,0 +1,142 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "program.h"
+
+#include "../runtime/output.h"
+
+namespace compiler::vm {
+
+void Program::emit(const parser::NodeTable& nodes,
+                   parser::NodeTable::Index node, uint32_t result,
+                   uint32_t lhs, uint32_t rhs) {
+  if (nodes.is_binary(node)) {
+    code_.push_back(Instruction{Instruction::Opcode(nodes.opcodes[node]),
+                                result, lhs, rhs});
+  } else {
+    code_.push_back(Instruction{Instruction::LOAD, result,
+                                static_cast<uint32_t>(constants_.size()), 0});
+    constants_.push_back(nodes.value(node));
+  }
+}
+
+void Program::add(const parser::NodeTable& nodes,
+                  parser::NodeTable::Index expression) {
+  uint32_t result;
+  if (nodes.is_sharing()) {
+    // Operands precede the nodes that use them, so we compute every node up
+    // to this expression that earlier expressions did not need
+    for (; computed_ <= expression; computed_++) {
+      emit(nodes, computed_, computed_, nodes.lhs[computed_],
+           nodes.rhs[computed_]);
+    }
+    registers_ = std::max(registers_, computed_);
+    result = expression;
+  } else {
+    // The subtree is stored in post-order, so the registers form a stack,
+    // and the operands of each binary node are the top two registers
+    uint32_t depth = 0;
+    nodes.visit_postorder(expression, [&](parser::NodeTable::Index node) {
+      if (nodes.is_binary(node)) {
+        depth--;
+        emit(nodes, node, depth - 1, depth - 1, depth);
+      } else {
+        emit(nodes, node, depth, 0, 0);
+        depth++;
+        registers_ = std::max(registers_, depth);
+      }
+    });
+    result = 0;
+  }
+  code_.push_back(Instruction{Instruction::PRINT, 0, result, 0});
+}
+
+void Program::run() {
+  code_.push_back(Instruction{Instruction::HALT, 0, 0, 0});
+  values_.resize(registers_);
+  auto r = values_.data();
+  auto constants = constants_.data();
+  auto ip = code_.data();
+
+  // Where we can take the address of a label, each instruction jumps
+  // directly to the next one, which predicts better than a central switch.
+  // Operations that wrap are computed on unsigned integers, whose overflow is
+  // defined in C++.
+#ifdef __GNUC__
+  // In the order of Instruction::Opcode
+  static const void* const labels[] = {
+      &&ADD,        &&SUBTRACT,    &&DIVIDE,  &&MULTIPLY, &&MOD,
+      &&SHIFT_LEFT, &&SHIFT_RIGHT, &&BIT_AND, &&BIT_OR,   &&BIT_XOR,
+      &&LOAD,       &&PRINT,       &&HALT,
+  };
+#define DISPATCH() goto* labels[ip->opcode]
+#define OPERATION(opcode) opcode:
+  DISPATCH();
+#else
+#define DISPATCH() continue
+#define OPERATION(opcode) case Instruction::opcode:
+  while (true) {
+    switch (ip->opcode) {
+#endif
+#define BINARY(opcode, type, op)                  \
+  OPERATION(opcode)                               \
+  r[ip->result] = static_cast<type>(r[ip->lhs]) op \
+      static_cast<type>(r[ip->rhs]);              \
+  ip++;                                           \
+  DISPATCH();
+
+  BINARY(ADD, uint64_t, +)
+  BINARY(SUBTRACT, uint64_t, -)
+  BINARY(DIVIDE, int64_t, /)
+  BINARY(MULTIPLY, uint64_t, *)
+  BINARY(MOD, int64_t, %)
+  BINARY(SHIFT_LEFT, uint64_t, <<)
+  BINARY(SHIFT_RIGHT, uint64_t, >>)
+  BINARY(BIT_AND, uint64_t, &)
+  BINARY(BIT_OR, uint64_t, |)
+  BINARY(BIT_XOR, uint64_t, ^)
+
+  OPERATION(LOAD)
+  r[ip->result] = constants[ip->lhs];
+  ip++;
+  DISPATCH();
+
+  OPERATION(PRINT)
+  runtime::print(r[ip->lhs]);
+  ip++;
+  DISPATCH();
+
+  OPERATION(HALT)
+#ifndef __GNUC__
+      goto halt;
+    }
+  }
+halt:
+#endif
+#undef BINARY
+#undef OPERATION
+#undef DISPATCH
+  code_.clear();
+  constants_.clear();
+}
+
+void Program::clear() {
+  code_.clear();
+  constants_.clear();
+  registers_ = 0;
+  values_.clear();
+  computed_ = 0;
+}
+
+}
@@ -0,0 +1,87 @@
+// Copyright 2020 Bret Taylor
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../core/common.h"
+#include "../parser/table.h"
+
+namespace compiler::vm {
+
+// A program for a simple register machine, which starts running much faster
+// than code compiled with LLVM. Each instruction computes one node of an
+// expression into a register. Registers are reused as soon as the node they
+// hold has been used, so even large expressions need few registers.
+class Program {
+ public:
+  // Appends instructions that print the value of the given expression.
+  // Nodes shared with expressions added earlier are not computed again.
+  void add(const parser::NodeTable& nodes, parser::NodeTable::Index expression);
+
+  // Runs the instructions added since the last run, printing values with
+  // runtime::print, and then discards them. Values of shared nodes are kept
+  // for the expressions added later. Operations that the checker reports as
+  // undefined are undefined here as well.
+  void run();
+
+  // Removes all instructions and values. Call this if the NodeTable passed to
+  // add() is cleared.
+  void clear();
+
+  // The number of instructions waiting to run.
+  inline size_t size() const {
+    return code_.size();
+  }
+
+ private:
+  struct Instruction {
+    // The binary opcodes match NodeTable::Opcode
+    enum Opcode : uint8_t {
+      ADD = parser::NodeTable::ADD,
+      SUBTRACT = parser::NodeTable::SUBTRACT,
+      DIVIDE = parser::NodeTable::DIVIDE,
+      MULTIPLY = parser::NodeTable::MULTIPLY,
+      MOD = parser::NodeTable::MOD,
+      SHIFT_LEFT = parser::NodeTable::SHIFT_LEFT,
+      SHIFT_RIGHT = parser::NodeTable::SHIFT_RIGHT,
+      BIT_AND = parser::NodeTable::BIT_AND,
+      BIT_OR = parser::NodeTable::BIT_OR,
+      BIT_XOR = parser::NodeTable::BIT_XOR,
+      LOAD,
+      PRINT,
+      HALT,
+    };
+
+    // LOAD reads `constants_[lhs]`, and PRINT prints register `lhs`.
+    Opcode opcode;
+    uint32_t result;
+    uint32_t lhs;
+    uint32_t rhs;
+  };
+
+  void emit(const parser::NodeTable& nodes, parser::NodeTable::Index node,
+            uint32_t result, uint32_t lhs, uint32_t rhs);
+
+  vector<Instruction> code_;
+  vector<int64_t> constants_;
+  uint32_t registers_ = 0;
+  vector<int64_t> values_;
+
+  // If the table shares nodes, every node has its own register so later
+  // expressions can use its value, and this is the number of nodes we have
+  // computed so far.
+  parser::NodeTable::Index computed_ = 0;
+};
+
+}